@@ -1,5 +1,7 @@
 #include "CLUtils.hpp"
 #include <string>
+#include <sstream>
+#include <stdexcept>
 
 namespace cl
 {
@@ -138,5 +140,63 @@ namespace cl
         }
     }
 
-}
+    cl::Device headlessDevice(int index)
+    {
+        std::vector<cl::Platform> platforms;
+        cl::Platform::get(&platforms);
+        std::vector<cl::Device> devices;
+        for (const auto &p : platforms)
+        {
+            std::vector<cl::Device> platformDevices;
+            p.getDevices(CL_DEVICE_TYPE_ALL, &platformDevices);
+            devices.insert(devices.end(), platformDevices.begin(), platformDevices.end());
+        }
+        if (index >= (int) devices.size())
+            return cl::Device();
+        if (index >= 0)
+            return devices[index];
+        for (const auto &d : devices)
+            if (d.getInfo<CL_DEVICE_TYPE>() == CL_DEVICE_TYPE_GPU)
+                return d;
+        return devices.empty() ? cl::Device() : devices[0];
+    }
+
+    std::vector<cl::Device> partitionDevice(const cl::Device &device, const std::string &partition)
+    {
+        std::vector<cl_device_partition_property> properties;
+        const std::string::size_type colon = partition.find(':');
+        const std::string kind = partition.substr(0, colon);
+        std::istringstream values(colon == std::string::npos ? "" : partition.substr(colon + 1));
+        std::string value;
+        try
+        {
+            if (kind == "equally" && std::getline(values, value))
+                properties = {CL_DEVICE_PARTITION_EQUALLY, (cl_device_partition_property) std::stoul(value), 0};
+            else if (kind == "counts")
+            {
+                properties.push_back(CL_DEVICE_PARTITION_BY_COUNTS);
+                while (std::getline(values, value, ','))
+                    properties.push_back((cl_device_partition_property) std::stoul(value));
+                if (properties.size() == 1)
+                    return std::vector<cl::Device>();
+                properties.push_back(CL_DEVICE_PARTITION_BY_COUNTS_LIST_END);
+                properties.push_back(0);
+            }
+            else if (kind == "numa")
+                properties = {CL_DEVICE_PARTITION_BY_AFFINITY_DOMAIN, CL_DEVICE_AFFINITY_DOMAIN_NUMA, 0};
+            else
+                return std::vector<cl::Device>();
+        }
+        catch (std::logic_error &)
+        {
+            // not a number
+            return std::vector<cl::Device>();
+        }
 
+        std::vector<cl::Device> subDevices;
+        cl::Device parent = device;
+        parent.createSubDevices(properties.data(), &subDevices);
+        return subDevices;
+    }
+
+}
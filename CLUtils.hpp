@@ -9,6 +9,25 @@ namespace cl
 
     extern std::string errorString(cl_int error);
 
+    /**
+     * device for a context without GL sharing
+     *
+     * @param index index into the devices of all platforms in the order the renderer prints them, -1 picks the first
+     * GPU, or any device if there is none
+     * @return a null device if there is no such device
+     */
+    extern cl::Device headlessDevice(int index = -1);
+
+    /**
+     * partitions a device (typically a CPU) into sub-devices, so a renderer on some of them leaves the other compute
+     * units free, e.g. for the event loop and the image encoding
+     *
+     * @param partition "equally:n" sub-devices of n compute units each, as many as fit, "counts:a,b,..." one sub-device
+     * per count with that many compute units, the remaining ones are left out, or "numa" one sub-device per NUMA node
+     * @return the sub-devices, empty if the partition can't be parsed, cl::Error if the device doesn't support it
+     */
+    extern std::vector<cl::Device> partitionDevice(const cl::Device &device, const std::string &partition);
+
 	inline unsigned int nextPowOfTwo(unsigned int n)
 	{
 		return 1 << ((unsigned int) ceil(log2(n)));
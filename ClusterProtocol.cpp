@@ -0,0 +1,143 @@
+#include <iostream>
+#include <cstring>
+#include <stdexcept>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include "ClusterProtocol.hpp"
+
+static_assert(sizeof(cluster::MessageHeader) == 8, "the message layout is part of the protocol");
+static_assert(sizeof(cluster::ViewMessage) == 96, "the message layout is part of the protocol");
+
+namespace cluster
+{
+	/**
+	 * fills the socket address for the address string, returns its length or 0 if it is malformed
+	 */
+	static socklen_t parseAddress(const std::string &address, sockaddr_storage &storage)
+	{
+		std::memset(&storage, 0, sizeof(storage));
+		if (address.compare(0, 5, "unix:") == 0)
+		{
+			sockaddr_un *unixAddress = (sockaddr_un *) &storage;
+			const std::string path = address.substr(5);
+			if (path.empty() || path.size() >= sizeof(unixAddress->sun_path))
+				return 0;
+			unixAddress->sun_family = AF_UNIX;
+			std::strcpy(unixAddress->sun_path, path.c_str());
+			return sizeof(sockaddr_un);
+		}
+		const size_t colon = address.rfind(':');
+		if (colon == std::string::npos)
+			return 0;
+		std::string host = address.substr(0, colon);
+		if (host == "localhost")
+			host = "127.0.0.1";
+		sockaddr_in *inetAddress = (sockaddr_in *) &storage;
+		inetAddress->sin_family = AF_INET;
+		const std::string portString = address.substr(colon + 1);
+		int port;
+		try
+		{
+			size_t end;
+			port = std::stoi(portString, &end);
+			if (end != portString.size())
+				return 0;
+		}
+		catch (std::logic_error &)
+		{
+			// not a number or out of the int range
+			return 0;
+		}
+		if (port < 0 || port > 65535)
+			return 0;
+		inetAddress->sin_port = htons((uint16_t) port);
+		if (inet_pton(AF_INET, host.c_str(), &inetAddress->sin_addr) != 1)
+			return 0;
+		return sizeof(sockaddr_in);
+	}
+
+	int listenOn(const std::string &address)
+	{
+		sockaddr_storage storage;
+		const socklen_t length = parseAddress(address, storage);
+		if (!length)
+		{
+			std::cerr << "[Cluster] invalid address " << address << std::endl;
+			return -1;
+		}
+		const int listener = socket(storage.ss_family, SOCK_STREAM, 0);
+		if (storage.ss_family == AF_UNIX)
+			unlink(((sockaddr_un *) &storage)->sun_path);
+		else
+		{
+			const int yes = 1;
+			setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+		}
+		if (listener < 0 || bind(listener, (sockaddr *) &storage, length) < 0 || listen(listener, 64) < 0)
+		{
+			std::cerr << "[Cluster] couldn't listen on " << address << std::endl;
+			if (listener >= 0)
+				close(listener);
+			return -1;
+		}
+		return listener;
+	}
+
+	int connectTo(const std::string &address)
+	{
+		sockaddr_storage storage;
+		const socklen_t length = parseAddress(address, storage);
+		if (!length)
+		{
+			std::cerr << "[Cluster] invalid address " << address << std::endl;
+			return -1;
+		}
+		const int connection = socket(storage.ss_family, SOCK_STREAM, 0);
+		if (connection < 0 || connect(connection, (sockaddr *) &storage, length) < 0)
+		{
+			if (connection >= 0)
+				close(connection);
+			return -1;
+		}
+		if (storage.ss_family == AF_INET)
+		{
+			const int yes = 1;
+			setsockopt(connection, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
+		}
+		return connection;
+	}
+
+	bool sendAll(int socket, const void *data, size_t size)
+	{
+		for (size_t sent = 0; sent < size;)
+		{
+			const ssize_t n = send(socket, (const char *) data + sent, size - sent, MSG_NOSIGNAL);
+			if (n <= 0)
+				return false;
+			sent += n;
+		}
+		return true;
+	}
+
+	bool sendMessage(int socket, MessageType type, const void *payload, size_t size)
+	{
+		const MessageHeader header = {type, (uint32_t) size};
+		return sendAll(socket, &header, sizeof(header)) && (!size || sendAll(socket, payload, size));
+	}
+
+	bool receiveAll(int socket, void *data, size_t size)
+	{
+		for (size_t received = 0; received < size;)
+		{
+			const ssize_t n = recv(socket, (char *) data + received, size - received, 0);
+			if (n <= 0)
+				return false;
+			received += n;
+		}
+		return true;
+	}
+}
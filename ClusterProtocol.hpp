@@ -0,0 +1,79 @@
+#pragma once
+
+#include <string>
+#include <cstdint>
+
+/**
+ * messages between the render coordinator and its workers. Every message is a MessageHeader followed by size bytes
+ * of payload. The fields are sent in the byte order of the host, so all machines of a cluster have to share it.
+ *
+ * worker -> coordinator: HELLO (name of the device), TILE (TileIndex followed by the RGBA8 texels of the tile)
+ * coordinator -> worker: VIEW (ViewMessage), ASSIGN (array of TileIndex), DONE (no payload)
+ */
+namespace cluster
+{
+	enum MessageType : uint32_t
+	{
+		HELLO = 1,
+		VIEW,
+		ASSIGN,
+		TILE,
+		DONE
+	};
+
+	struct MessageHeader
+	{
+		uint32_t type;
+		uint32_t size;
+	};
+
+	/**
+	 * the image to render, the pixel (x, y) is at zoom * (((x, y) + 0.5) / width + pos), y points up. juliaC is only used
+	 * by the julia formula
+	 */
+	struct ViewMessage
+	{
+		double zoom;
+		double posX;
+		double posY;
+		double juliaCX;
+		double juliaCY;
+		int32_t iterations;
+		uint32_t width;
+		uint32_t height;
+		float color[3];
+		char formula[32];
+	};
+
+	/**
+	 * tile (x, y) covers the pixels [x, x + 1) * TILE_SIZE horizontally and vertically
+	 */
+	struct TileIndex
+	{
+		uint32_t x;
+		uint32_t y;
+	};
+
+	// has to match TILE_SIZE in the kernel
+	const uint32_t TILE_SIZE = 256;
+
+	/**
+	 * @param address "unix:/path/to/socket" or "host:port" with a numeric IPv4 host or localhost
+	 * @return the listening socket, -1 on failure
+	 */
+	int listenOn(const std::string &address);
+
+	/**
+	 * @return the connected socket, -1 on failure
+	 */
+	int connectTo(const std::string &address);
+
+	bool sendAll(int socket, const void *data, size_t size);
+
+	bool sendMessage(int socket, MessageType type, const void *payload = nullptr, size_t size = 0);
+
+	/**
+	 * blocks until size bytes are read, returns false if the connection was closed before
+	 */
+	bool receiveAll(int socket, void *data, size_t size);
+}
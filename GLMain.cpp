@@ -6,11 +6,9 @@
 #include <sstream>
 #include "GLMain.hpp"
 
-GLMain::GLMain(SDL_Window *window, SDL_GLContext &context)
+GLMain::GLMain(SDL_Window *window, SDL_GLContext &context, const RenderThread::View &view)
 {
-	int w, h;
-	SDL_GetWindowSize(window, &w, &h);
-	initialize(w, h, window, context);
+	initialize(window, context, view);
 }
 
 GLMain::~GLMain()
@@ -20,11 +18,11 @@ GLMain::~GLMain()
 
 void GLMain::cleanup()
 {
+	renderThread.reset();
 	glDeleteBuffers(1, &vbo);
-	oclRenderer.reset();
 }
 
-void GLMain::initialize(size_t width, size_t height, SDL_Window *window, SDL_GLContext &context)
+void GLMain::initialize(SDL_Window *window, SDL_GLContext &context, const RenderThread::View &view)
 {
 	/********** OpenGL Context and GLEW **********/
 	context = SDL_GL_CreateContext(window);
@@ -43,12 +41,8 @@ void GLMain::initialize(size_t width, size_t height, SDL_Window *window, SDL_GLC
 	/********** Vsync **********/
 	SDL_GL_SetSwapInterval(1);
 
-	/********** OpenCL initialization **********/
-#ifdef USE_DOUBLE
-	oclRenderer.reset(new OCLRenderer(width, height, 0, "mandelbrot", "kernels/default_double.cl"));
-#else
-	oclRenderer.reset(new OCLRenderer(width, height, 0, "mandelbrot", "kernels/default.cl"));
-#endif
+	/********** OpenCL initialization on the render thread **********/
+	renderThread.reset(new RenderThread(window, view, "mandelbrot", "kernels/default.cl"));
 
 	/********** setup shader **********/
 	shaderProgram.reset(new ShaderProgram("default"));
@@ -86,49 +80,26 @@ void GLMain::initialize(size_t width, size_t height, SDL_Window *window, SDL_GLC
 void GLMain::reshape(int width, int height)
 {
 	glViewport(0, 0, width, height);
-	oclRenderer->reshape(width, height);
-	oclRenderer->render(true);
 }
 
-void GLMain::display()
+const RenderThread::Frame &GLMain::display()
 {
 	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+	const RenderThread::Frame &frame = renderThread->latestFrame();
+	if (!frame.width)
+		return frame;
 
 	shaderProgram->bind();
 	shaderProgram->setUniform1i("srcTex", 0);
-	glBindTexture(GL_TEXTURE_2D, oclRenderer->getTexture().id);
+	glBindTexture(GL_TEXTURE_2D, frame.texture);
 	glBindBuffer(GL_ARRAY_BUFFER, vbo);
 	glBindVertexArray(vao);
 	glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
 	glBindTexture(GL_TEXTURE_2D, 0);
+	return frame;
 }
 
-void GLMain::saveRenderedImage()
+RenderThread *GLMain::getRenderThread()
 {
-	// save the rendered image
-	glFinish();
-	size_t width = oclRenderer->getTexture().width;
-	size_t height = oclRenderer->getTexture().height;
-	uint32_t *pixels = new uint32_t[width * height];
-	auto rawImage = oclRenderer->getImage();
-
-	// simple linear tone mapping
-	for (size_t i = 0; i < width * height * 4; i += 4)
-		pixels[i / 4] = (((uint32_t) std::min(0xFF, std::max(0x0, (int) ((*rawImage)[i + 0] * 255.0f)))) << 24) |
-		                (((uint32_t) std::min(0xFF, std::max(0x0, (int) ((*rawImage)[i + 1] * 255.0f)))) << 16) |
-		                (((uint32_t) std::min(0xFF, std::max(0x0, (int) ((*rawImage)[i + 2] * 255.0f)))) << 8) |
-		                (((uint32_t) std::min(0xFF, std::max(0x0, (int) ((*rawImage)[i + 3] * 255.0f)))) << 0);
-
-	SDL_Surface *image = SDL_CreateRGBSurfaceFrom(pixels, width, height, 32, 4 * width, 0xFF000000, 0x00FF0000,
-	                                              0x0000FF00, 0x000000FF);
-	std::ostringstream stringStream;
-	stringStream << "render_" << time(nullptr) << "_" << oclRenderer->getSampleCount() << "SPP.bmp";
-	SDL_SaveBMP(image, stringStream.str().c_str());
-	SDL_FreeSurface(image);
-	delete[] pixels;
+	return renderThread.get();
 }
-
-OCLRenderer *GLMain::getOclRenderer()
-{
-	return oclRenderer.get();
-}
\ No newline at end of file
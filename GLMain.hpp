@@ -2,7 +2,7 @@
 
 
 #include "ShaderProgram.hpp"
-#include "OCLRenderer.hpp"
+#include "RenderThread.hpp"
 #include <SDL2/SDL.h>
 #include <memory>
 
@@ -10,44 +10,40 @@ class GLMain
 {
 private:
 	std::shared_ptr<ShaderProgram> shaderProgram;
-	std::shared_ptr<OCLRenderer> oclRenderer;
+	std::shared_ptr<RenderThread> renderThread;
 	GLuint vao;
 	GLuint vbo;
 
 	/**
-	 * initializes a basic opengl window and the opencl renderer
+	 * initializes a basic opengl window and starts the render thread with the view
 	 */
-	void initialize(size_t width, size_t height, SDL_Window *window, SDL_GLContext &context);
+	void initialize(SDL_Window *window, SDL_GLContext &context, const RenderThread::View &view);
 
 public:
-	GLMain(SDL_Window *window, SDL_GLContext &context);
+	GLMain(SDL_Window *window, SDL_GLContext &context, const RenderThread::View &view);
 
 	~GLMain();
 
 	/**
-	 * deletes all the acquired buffers and the opencl renderer
+	 * deletes all the acquired buffers and stops the render thread
 	 */
 	void cleanup();
 
 	/**
-	 * displays the rendered texture
+	 * displays the newest frame of the render thread
+	 *
+	 * @return the frame that was drawn, its width is 0 before the first one
 	 */
-	void display();
+	const RenderThread::Frame &display();
 
 	/**
-	 * resizes the opengl screen and does the same to the opencl renderer
+	 * resizes the opengl screen, the renderer follows the size of the posted view
 	 */
 	void reshape(int width, int height);
 
 	/**
-	 * saves a screencapture in the current directory with the following name scheme:
-	 * render_{CURRENT_TIME}_{SAMPLE_COUNT}_Spp.bmp
+	 * reference to the render thread
 	 */
-	void saveRenderedImage();
-
-	/**
-	 * reference to the opencl renderer
-	 */
-	OCLRenderer * getOclRenderer();
+	RenderThread * getRenderThread();
 };
 
@@ -0,0 +1,268 @@
+#include <iostream>
+#include <sstream>
+#include <algorithm>
+#include <deque>
+#include <thread>
+#include "InputTrace.hpp"
+#include "Statistics.hpp"
+
+constexpr double InputTrace::REFRESH_SECONDS;
+constexpr double InputTrace::DRAIN_SECONDS;
+
+/**
+ * writes the kind and values of an input event as in the trace files
+ *
+ * @return false if the event isn't input
+ */
+static bool describe(const SDL_Event &event, std::ostream &out)
+{
+	switch (event.type)
+	{
+		case SDL_QUIT:
+			out << "quit";
+			return true;
+		case SDL_WINDOWEVENT:
+			if (event.window.event != SDL_WINDOWEVENT_RESIZED)
+				return false;
+			out << "resize " << event.window.data1 << " " << event.window.data2;
+			return true;
+		case SDL_KEYDOWN:
+			out << "key " << event.key.keysym.sym;
+			return true;
+		case SDL_MOUSEBUTTONDOWN:
+		case SDL_MOUSEBUTTONUP:
+			out << (event.type == SDL_MOUSEBUTTONDOWN ? "down " : "up ") << (int) event.button.button << " " << event.button.x << " " <<
+			event.button.y;
+			return true;
+		case SDL_MOUSEWHEEL:
+			out << "wheel " << event.wheel.y;
+			return true;
+		case SDL_MOUSEMOTION:
+			out << "motion " << event.motion.x << " " << event.motion.y << " " << event.motion.xrel << " " << event.motion.yrel;
+			return true;
+		default:
+			return false;
+	}
+}
+
+InputTrace::InputTrace(const std::string &filename) : file(filename), start(std::chrono::steady_clock::now())
+{
+	if (!file)
+		std::cerr << "[InputTrace] couldn't open " << filename << std::endl;
+}
+
+bool InputTrace::isOpen() const
+{
+	return file.is_open();
+}
+
+void InputTrace::record(const SDL_Event &event)
+{
+	std::ostringstream line;
+	if (!describe(event, line))
+		return;
+	file << std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() << " " << line.str() << "\n";
+}
+
+bool InputTrace::load(const std::string &filename, std::vector<Entry> &entries)
+{
+	std::ifstream file(filename);
+	if (!file)
+		return false;
+	std::string line;
+	while (std::getline(file, line))
+	{
+		std::istringstream values(line);
+		Entry entry;
+		std::string kind;
+		if (!(values >> entry.seconds >> kind))
+			continue;
+		SDL_zero(entry.event);
+		SDL_Event &event = entry.event;
+		int button = 0;
+		bool valid = true;
+		if (kind == "quit")
+			event.type = SDL_QUIT;
+		else if (kind == "resize")
+		{
+			event.type = SDL_WINDOWEVENT;
+			event.window.event = SDL_WINDOWEVENT_RESIZED;
+			valid = (bool) (values >> event.window.data1 >> event.window.data2);
+		}
+		else if (kind == "key")
+		{
+			event.type = SDL_KEYDOWN;
+			event.key.state = SDL_PRESSED;
+			valid = (bool) (values >> event.key.keysym.sym);
+		}
+		else if (kind == "down" || kind == "up")
+		{
+			event.type = kind == "down" ? SDL_MOUSEBUTTONDOWN : SDL_MOUSEBUTTONUP;
+			event.button.state = kind == "down" ? SDL_PRESSED : SDL_RELEASED;
+			valid = (bool) (values >> button >> event.button.x >> event.button.y);
+			event.button.button = (Uint8) button;
+		}
+		else if (kind == "wheel")
+		{
+			event.type = SDL_MOUSEWHEEL;
+			valid = (bool) (values >> event.wheel.y);
+		}
+		else if (kind == "motion")
+		{
+			event.type = SDL_MOUSEMOTION;
+			valid = (bool) (values >> event.motion.x >> event.motion.y >> event.motion.xrel >> event.motion.yrel);
+		}
+		else
+			valid = false;
+		if (valid)
+			entries.push_back(entry);
+	}
+	return true;
+}
+
+bool InputTrace::replay(const std::vector<Entry> &entries, SDL_Window *window, GLMain &glMain, ViewControl &control,
+                        const std::string &reportFilename)
+{
+	typedef std::chrono::steady_clock Clock;
+	auto milliseconds = [](Clock::duration duration)
+	{
+		return std::chrono::duration<double, std::milli>(duration).count();
+	};
+	RenderThread *renderThread = glMain.getRenderThread();
+	SDL_Event ignored;
+
+	// the first frame waits for the kernels, the replay starts after it
+	while (!glMain.display().width)
+	{
+		SDL_GL_SwapWindow(window);
+		while (SDL_PollEvent(&ignored));
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+	}
+
+	// a posted view that wasn't shown yet and the events that changed it
+	struct Posted
+	{
+		unsigned sequence;
+		std::vector<size_t> events;
+	};
+	std::deque<Posted> waiting;
+	std::vector<size_t> changes;
+	// of every event, negative if it didn't change the view or was never shown
+	std::vector<double> latencies(entries.size(), -1.0);
+	std::vector<double> frameTimes;
+	size_t posted = 0;
+	size_t refreshes = 0;
+	size_t dropped = 0;
+	unsigned sequence = 0;
+	unsigned long lastIndex = glMain.getRenderThread()->latestFrame().index;
+	Clock::time_point lastFrame;
+	// the render thread worked since the last new frame, the time since then is a frame time
+	bool busy = false;
+	const Clock::time_point start = Clock::now();
+	auto at = [start](double seconds)
+	{
+		return start + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(seconds));
+	};
+	const double duration = entries.empty() ? 0.0 : entries.back().seconds;
+	size_t next = 0;
+	for (size_t tick = 0; ; ++tick)
+	{
+		std::this_thread::sleep_until(at(tick * REFRESH_SECONDS));
+		const double now = std::chrono::duration<double>(Clock::now() - start).count();
+		for (; next < entries.size() && entries[next].seconds <= now; ++next)
+		{
+			const SDL_Event &event = entries[next].event;
+			if (event.type == SDL_WINDOWEVENT)
+			{
+				SDL_SetWindowSize(window, event.window.data1, event.window.data2);
+				glMain.reshape(event.window.data1, event.window.data2);
+			}
+			if (control.handle(event))
+				changes.push_back(next);
+		}
+		// all events of a refresh end up in one view, like in the event loop
+		if (!changes.empty())
+		{
+			RenderThread::View view = control.getView();
+			view.sequence = ++sequence;
+			renderThread->post(view);
+			waiting.push_back({sequence, changes});
+			changes.clear();
+			++posted;
+		}
+
+		const RenderThread::Frame &frame = glMain.display();
+		SDL_GL_SwapWindow(window);
+		glFinish();
+		const Clock::time_point shown = Clock::now();
+		while (SDL_PollEvent(&ignored));
+		++refreshes;
+		if (frame.index != lastIndex)
+		{
+			if (busy)
+				frameTimes.push_back(milliseconds(shown - lastFrame));
+			lastIndex = frame.index;
+			lastFrame = shown;
+			busy = true;
+			while (!waiting.empty() && waiting.front().sequence <= frame.sequence)
+			{
+				// from the recorded time of the event, it waited for the next refresh like in the event loop
+				for (size_t event : waiting.front().events)
+					latencies[event] = milliseconds(shown - at(entries[event].seconds));
+				waiting.pop_front();
+			}
+		}
+		else if (!waiting.empty())
+			++dropped;
+		// the time the render thread waited for input isn't a frame time
+		if (renderThread->isIdle())
+			busy = false;
+		if (next == entries.size() && (waiting.empty() || now > duration + DRAIN_SECONDS))
+			break;
+	}
+
+	std::ofstream report(reportFilename);
+	if (report)
+		report << "seconds,event,latency_ms" << std::endl;
+	std::vector<double> shownLatencies;
+	size_t lost = 0;
+	for (size_t e = 0; e < entries.size(); ++e)
+	{
+		const bool changed = latencies[e] >= 0.0 || std::any_of(waiting.begin(), waiting.end(), [e](const Posted &p)
+		{
+			return std::find(p.events.begin(), p.events.end(), e) != p.events.end();
+		});
+		if (!changed)
+			continue;
+		if (latencies[e] >= 0.0)
+			shownLatencies.push_back(latencies[e]);
+		else
+			++lost;
+		if (report)
+		{
+			report << entries[e].seconds << ",";
+			describe(entries[e].event, report);
+			report << ",";
+			if (latencies[e] >= 0.0)
+				report << latencies[e];
+			report << std::endl;
+		}
+	}
+
+	std::cout << "[InputTrace] replayed " << entries.size() << " events in " << duration << " s, " << posted << " views posted" << std::endl;
+	std::cout << "[InputTrace] input to photon latency of " << shownLatencies.size() << " events: p50 " << percentile(shownLatencies, 0.5) <<
+	" ms, p95 " << percentile(shownLatencies, 0.95) << " ms, p99 " << percentile(shownLatencies, 0.99) << " ms, max " <<
+	percentile(shownLatencies, 1.0) << " ms" << std::endl;
+	std::cout << "[InputTrace] frame times of " << frameTimes.size() << " frames: p50 " << percentile(frameTimes, 0.5) << " ms, p95 " <<
+	percentile(frameTimes, 0.95) << " ms, p99 " << percentile(frameTimes, 0.99) << " ms" << std::endl;
+	std::cout << "[InputTrace] dropped frames: " << dropped << " of " << refreshes << " refreshes showed no new frame while a view was waiting" << std::endl;
+	if (lost)
+		std::cout << "[InputTrace] " << lost << " events were never shown" << std::endl;
+	if (!report)
+	{
+		std::cerr << "[InputTrace] couldn't write " << reportFilename << std::endl;
+		return false;
+	}
+	std::cout << "[InputTrace] latencies of every event written to " << reportFilename << std::endl;
+	return true;
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <SDL2/SDL.h>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <chrono>
+#include "GLMain.hpp"
+#include "ViewControl.hpp"
+
+/**
+ * records the input events of the window with their time to a text file and replays them against the renderer to
+ * measure the interaction latency. The file has one event per line, "{seconds} {kind} {values}":
+ * quit, resize {width} {height}, key {keycode}, down/up {button} {x} {y}, wheel {y} and motion {x} {y} {xrel} {yrel}
+ */
+class InputTrace
+{
+public:
+	struct Entry
+	{
+		// since the start of the recording
+		double seconds;
+		SDL_Event event;
+	};
+
+private:
+	// the display refresh the replay is paced at
+	static constexpr double REFRESH_SECONDS = 1.0 / 60.0;
+	// views that aren't shown this long after the last event are given up
+	static constexpr double DRAIN_SECONDS = 10.0;
+
+	std::ofstream file;
+	std::chrono::steady_clock::time_point start;
+
+public:
+	/**
+	 * starts recording to the file, the times are relative to this call
+	 */
+	InputTrace(const std::string &filename);
+
+	bool isOpen() const;
+
+	/**
+	 * appends the event if it is input, the other events are skipped
+	 */
+	void record(const SDL_Event &event);
+
+	/**
+	 * @return false if the file couldn't be read, lines that aren't events are skipped
+	 */
+	static bool load(const std::string &filename, std::vector<Entry> &entries);
+
+	/**
+	 * feeds the events to the view control at their recorded times, posts the changed views and draws the newest
+	 * frame once per refresh. The time from the recorded time of an event to drawing the first frame rendered with
+	 * the view it changed or a later one is its input to photon latency. Prints the latency percentiles, the frame
+	 * times while the renderer was busy and the refreshes that showed no new frame while a view was waiting
+	 * (dropped frames), and writes the latency of every event to {reportFilename}
+	 *
+	 * @return false if the report couldn't be written
+	 */
+	static bool replay(const std::vector<Entry> &entries, SDL_Window *window, GLMain &glMain, ViewControl &control,
+	                   const std::string &reportFilename);
+};
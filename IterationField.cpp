@@ -0,0 +1,147 @@
+#include <iostream>
+#include <cstring>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "IterationField.hpp"
+
+static_assert(sizeof(IterationField::Header) == 96, "the header layout is part of the file format");
+
+const char IterationField::MAGIC[8] = {'M', 'B', 'C', 'L', 'F', 'L', 'D', '\0'};
+
+IterationField::Header IterationField::makeHeader(uint32_t width, uint32_t height, bool half)
+{
+	Header header;
+	std::memset(&header, 0, sizeof(header));
+	std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+	header.version = VERSION;
+	header.payloadOffset = PAYLOAD_OFFSET;
+	header.width = width;
+	header.height = height;
+	header.tileSize = TILE_SIZE;
+	header.channels = CHANNELS;
+	header.sampleBytes = half ? 2 : 4;
+	return header;
+}
+
+size_t IterationField::tileBytes(const Header &header)
+{
+	return (size_t) header.tileSize * header.tileSize * header.channels * header.sampleBytes;
+}
+
+size_t IterationField::tilesX(const Header &header)
+{
+	return (header.width + header.tileSize - 1) / header.tileSize;
+}
+
+size_t IterationField::tilesY(const Header &header)
+{
+	return (header.height + header.tileSize - 1) / header.tileSize;
+}
+
+size_t IterationField::fileSize(const Header &header)
+{
+	return header.payloadOffset + tilesX(header) * tilesY(header) * tileBytes(header);
+}
+
+float IterationField::halfToFloat(uint16_t half)
+{
+	const uint32_t sign = (uint32_t) (half & 0x8000) << 16;
+	uint32_t exponent = (half >> 10) & 0x1F;
+	uint32_t mantissa = half & 0x3FF;
+	uint32_t bits;
+	if (exponent == 0x1F)
+		bits = sign | 0x7F800000 | (mantissa << 13);
+	else if (exponent)
+		bits = sign | ((exponent + 112) << 23) | (mantissa << 13);
+	else if (mantissa)
+	{
+		// subnormal, normalize it
+		exponent = 113;
+		while (!(mantissa & 0x400))
+		{
+			mantissa <<= 1;
+			--exponent;
+		}
+		bits = sign | (exponent << 23) | ((mantissa & 0x3FF) << 13);
+	}
+	else
+		bits = sign;
+	float value;
+	std::memcpy(&value, &bits, sizeof(value));
+	return value;
+}
+
+IterationField::IterationField(const std::string &filename) : file(-1), size(0), data(nullptr)
+{
+	std::memset(&header, 0, sizeof(header));
+	file = open(filename.c_str(), O_RDONLY);
+	struct stat info;
+	if (file < 0 || fstat(file, &info) < 0 || (size_t) info.st_size < sizeof(Header))
+	{
+		std::cerr << "[IterationField] couldn't open " << filename << std::endl;
+		return;
+	}
+	size = (size_t) info.st_size;
+	void *mapping = mmap(nullptr, size, PROT_READ, MAP_SHARED, file, 0);
+	if (mapping == MAP_FAILED)
+	{
+		std::cerr << "[IterationField] couldn't map " << filename << std::endl;
+		return;
+	}
+	data = (const unsigned char *) mapping;
+	std::memcpy(&header, data, sizeof(header));
+	if (std::memcmp(header.magic, MAGIC, sizeof(MAGIC)) || header.version != VERSION || header.channels != CHANNELS ||
+	    (header.sampleBytes != 2 && header.sampleBytes != 4) || header.tileSize == 0 || fileSize(header) > size)
+	{
+		std::cerr << "[IterationField] " << filename << " is no valid iteration field" << std::endl;
+		munmap(mapping, size);
+		data = nullptr;
+	}
+}
+
+IterationField::~IterationField()
+{
+	if (data)
+		munmap((void *) data, size);
+	if (file >= 0)
+		close(file);
+}
+
+bool IterationField::isValid() const
+{
+	return data != nullptr;
+}
+
+const IterationField::Header &IterationField::getHeader() const
+{
+	return header;
+}
+
+float IterationField::sample(size_t x, size_t y, size_t channel) const
+{
+	const size_t tile = (y / header.tileSize) * tilesX(header) + x / header.tileSize;
+	const size_t texel = (y % header.tileSize) * header.tileSize + x % header.tileSize;
+	const unsigned char *value = data + header.payloadOffset + tile * tileBytes(header) +
+	                             (texel * header.channels + channel) * header.sampleBytes;
+	if (header.sampleBytes == 2)
+	{
+		uint16_t half;
+		std::memcpy(&half, value, sizeof(half));
+		return halfToFloat(half);
+	}
+	float single;
+	std::memcpy(&single, value, sizeof(single));
+	return single;
+}
+
+float IterationField::smoothIteration(size_t x, size_t y) const
+{
+	return sample(x, y, 0);
+}
+
+float IterationField::absolute(size_t x, size_t y) const
+{
+	return sample(x, y, 1);
+}
@@ -0,0 +1,102 @@
+#pragma once
+
+#include <string>
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * raw iteration field files, which keep the smooth iteration count (-1 inside the set) and the final |z| of every
+ * pixel, so a deep render can be recolored or analysed without computing it again.
+ *
+ * The file starts with a Header padded to PAYLOAD_OFFSET bytes, followed by the tiles of tileSize x tileSize pixels
+ * in row major order, the tiles at the right and bottom border are padded with zeros. The pixels inside a tile are
+ * row major as well, each with the two channels interleaved as float32 or float16. The header and the payload are
+ * written in the byte order of the host, so the files can only be read on machines that share it, a file of the
+ * other byte order fails the version check. Every tile can be addressed directly, so the file is meant to be mapped into memory, which this class does
+ */
+class IterationField
+{
+public:
+	struct Header
+	{
+		// "MBCLFLD" followed by a zero
+		char magic[8];
+		uint32_t version;
+		// offset of the first tile in bytes
+		uint32_t payloadOffset;
+		uint32_t width;
+		uint32_t height;
+		uint32_t tileSize;
+		// 2: smooth iteration count, |z|
+		uint32_t channels;
+		// 4 for float32, 2 for float16
+		uint32_t sampleBytes;
+		int32_t iterations;
+		// view of the render, the pixel (x, y) is at zoom * ((x + 0.5) / width + pos)
+		double zoom;
+		double posX;
+		double posY;
+		char formula[32];
+	};
+
+	static const char MAGIC[8];
+	static const uint32_t VERSION = 1;
+	static const uint32_t PAYLOAD_OFFSET = 4096;
+	static const uint32_t TILE_SIZE = 64;
+	static const uint32_t CHANNELS = 2;
+
+private:
+	int file;
+	size_t size;
+	const unsigned char *data;
+	Header header;
+
+	/**
+	 * @return the channel of the pixel (x, y) as float
+	 */
+	float sample(size_t x, size_t y, size_t channel) const;
+
+public:
+	/**
+	 * @return a header for a field of the given size and format with the other fields zeroed
+	 */
+	static Header makeHeader(uint32_t width, uint32_t height, bool half);
+
+	static size_t tileBytes(const Header &header);
+
+	/**
+	 * @return the number of tiles in x direction
+	 */
+	static size_t tilesX(const Header &header);
+
+	static size_t tilesY(const Header &header);
+
+	static size_t fileSize(const Header &header);
+
+	static float halfToFloat(uint16_t half);
+
+	/**
+	 * maps the file read-only into memory, an invalid file leaves the field empty
+	 */
+	IterationField(const std::string &filename);
+
+	~IterationField();
+
+	IterationField(const IterationField &) = delete;
+
+	IterationField &operator=(const IterationField &) = delete;
+
+	bool isValid() const;
+
+	const Header &getHeader() const;
+
+	/**
+	 * @return the smooth iteration count of the pixel, -1 inside the set
+	 */
+	float smoothIteration(size_t x, size_t y) const;
+
+	/**
+	 * @return |z| after the last iteration of the pixel
+	 */
+	float absolute(size_t x, size_t y) const;
+};
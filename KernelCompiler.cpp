@@ -0,0 +1,111 @@
+#include <algorithm>
+#include "KernelCompiler.hpp"
+
+KernelCompiler::KernelCompiler(const cl::Context &context, const cl::Device &device, const std::string &source)
+		: context(context), device(device), source(source), running(true)
+{
+	thread = std::thread(&KernelCompiler::run, this);
+}
+
+KernelCompiler::~KernelCompiler()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		running = false;
+	}
+	changed.notify_all();
+	thread.join();
+}
+
+void KernelCompiler::request(const std::string &options, bool urgent)
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		auto variant = variants.find(options);
+		if (variant != variants.end())
+		{
+			// move a queued variant to the front
+			if (urgent && variant->second.state == QUEUED)
+			{
+				queue.erase(std::find(queue.begin(), queue.end(), options));
+				queue.push_front(options);
+			}
+			return;
+		}
+		variants[options] = {QUEUED, false, cl::Program()};
+		if (urgent)
+			queue.push_front(options);
+		else
+			queue.push_back(options);
+	}
+	changed.notify_all();
+}
+
+bool KernelCompiler::isReady(const std::string &options)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	auto variant = variants.find(options);
+	return variant != variants.end() && variant->second.state == DONE;
+}
+
+cl::Program KernelCompiler::get(const std::string &options, bool &built)
+{
+	std::unique_lock<std::mutex> lock(mutex);
+	auto variant = variants.find(options);
+	if (variant == variants.end() || variant->second.state == QUEUED)
+	{
+		// build it right away instead of waiting for its turn
+		if (variant == variants.end())
+			variant = variants.insert(std::make_pair(options, Variant({BUILDING, false, cl::Program()}))).first;
+		else
+			queue.erase(std::find(queue.begin(), queue.end(), options));
+		variant->second.state = BUILDING;
+		lock.unlock();
+		build(options, variant->second);
+		lock.lock();
+	}
+	changed.wait(lock, [&variant] { return variant->second.state == DONE; });
+	built = variant->second.built;
+	return variant->second.program;
+}
+
+void KernelCompiler::run()
+{
+	std::unique_lock<std::mutex> lock(mutex);
+	for (;;)
+	{
+		changed.wait(lock, [this] { return !running || !queue.empty(); });
+		if (!running)
+			return;
+		const std::string options = queue.front();
+		queue.pop_front();
+		Variant &variant = variants[options];
+		variant.state = BUILDING;
+		lock.unlock();
+		build(options, variant);
+		lock.lock();
+	}
+}
+
+void KernelCompiler::build(const std::string &options, Variant &variant)
+{
+	// the entries of the map stay where they are, so the variant can be filled in without the mutex
+	cl::Program program;
+	bool built = true;
+	try
+	{
+		program = cl::Program(context, cl::Program::Sources(1, std::make_pair(source.c_str(), source.length() + 1)));
+		program.build(std::vector<cl::Device>(1, device), options.c_str());
+	}
+	catch (cl::Error error)
+	{
+		built = false;
+	}
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		variant.program = program;
+		variant.built = built;
+		variant.state = DONE;
+	}
+	changed.notify_all();
+}
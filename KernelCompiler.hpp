@@ -0,0 +1,87 @@
+#pragma once
+
+#define __CL_ENABLE_EXCEPTIONS
+
+#include <CL/cl.hpp>
+#include <string>
+#include <map>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+
+/**
+ * builds the variants of the kernel template on a background thread and keeps them, so the renderer can switch to
+ * a variant without waiting for the compiler. A variant is identified by its build options
+ */
+class KernelCompiler
+{
+private:
+	enum State
+	{
+		QUEUED,
+		BUILDING,
+		DONE
+	};
+
+	struct Variant
+	{
+		State state;
+		bool built;
+		cl::Program program;
+	};
+
+	cl::Context context;
+	cl::Device device;
+	std::string source;
+
+	std::mutex mutex;
+	// signals queued variants to the background thread and finished ones to the waiting callers
+	std::condition_variable changed;
+	std::map<std::string, Variant> variants;
+	std::deque<std::string> queue;
+	bool running;
+	std::thread thread;
+
+	/**
+	 * builds the queued variants until the compiler is destroyed
+	 */
+	void run();
+
+	/**
+	 * builds the variant on the calling thread, the mutex must not be held
+	 */
+	void build(const std::string &options, Variant &variant);
+
+public:
+	KernelCompiler(const cl::Context &context, const cl::Device &device, const std::string &source);
+
+	/**
+	 * waits for the build in progress, queued variants are dropped
+	 */
+	~KernelCompiler();
+
+	KernelCompiler(const KernelCompiler &) = delete;
+
+	KernelCompiler &operator=(const KernelCompiler &) = delete;
+
+	/**
+	 * queues the variant for the background thread if it isn't known yet
+	 *
+	 * @param urgent builds it before the other queued variants
+	 */
+	void request(const std::string &options, bool urgent = false);
+
+	/**
+	 * @return true if the variant was requested and its build finished, successfully or not
+	 */
+	bool isReady(const std::string &options);
+
+	/**
+	 * builds the variant on the calling thread if it isn't built yet, or waits for the background thread if it is
+	 * building it right now
+	 *
+	 * @param built set to false if the build failed, the program has the build log
+	 */
+	cl::Program get(const std::string &options, bool &built);
+};
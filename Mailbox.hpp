@@ -0,0 +1,76 @@
+#pragma once
+
+#include <atomic>
+
+/**
+ * lock-free handoff of the latest value from one writer thread to one reader thread, older values that weren't
+ * read yet are overwritten. The three slots rotate between the writer, the reader and the handoff, so neither side
+ * ever waits for the other or sees a half written value
+ */
+template<typename T>
+class Mailbox
+{
+private:
+	// set on the handoff slot while it holds a value the reader hasn't taken yet
+	static const unsigned FRESH = 4;
+
+	T slots[3];
+	std::atomic<unsigned> middle;
+	// owned by the writer
+	unsigned writing;
+	// owned by the reader
+	unsigned reading;
+
+public:
+	Mailbox() : middle(1), writing(0), reading(2)
+	{ }
+
+	Mailbox(const Mailbox &) = delete;
+
+	Mailbox &operator=(const Mailbox &) = delete;
+
+	/**
+	 * @return the slot of the writer, it is handed to the reader by publish
+	 */
+	T &back()
+	{
+		return slots[writing];
+	}
+
+	/**
+	 * hands the back slot to the reader, the writer continues with the slot of the previous handoff
+	 */
+	void publish()
+	{
+		writing = middle.exchange(writing | FRESH, std::memory_order_acq_rel) & ~FRESH;
+	}
+
+	/**
+	 * takes the latest published value if there is a new one
+	 *
+	 * @return true if front changed
+	 */
+	bool update()
+	{
+		if (!(middle.load(std::memory_order_relaxed) & FRESH))
+			return false;
+		reading = middle.exchange(reading, std::memory_order_acq_rel) & ~FRESH;
+		return true;
+	}
+
+	/**
+	 * @return the slot of the reader, the latest value taken by update
+	 */
+	const T &front() const
+	{
+		return slots[reading];
+	}
+
+	/**
+	 * all slots, for initializing or freeing them while no other thread uses the mailbox
+	 */
+	T *data()
+	{
+		return slots;
+	}
+};
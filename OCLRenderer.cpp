@@ -5,8 +5,15 @@
 #include <iostream>
 #include <fstream>
 #include <sstream>
+#include <chrono>
+#include <cmath>
+#include <limits>
+#include <algorithm>
+#include <map>
 #include "OCLRenderer.hpp"
 #include "CLUtils.hpp"
+#include "TuningCache.hpp"
+#include "IterationField.hpp"
 
 #ifdef __linux__
 
@@ -20,8 +27,105 @@
 #include <OpenGL/OpenGL.h>
 #endif
 
-OCLRenderer::OCLRenderer(size_t width, size_t height, size_t gpuNum, const std::string &kernelname,
-                         const std::string &sourceFilename) : texture(Texture(width, height)), zoom(1.0f), pos({0.0f, 0.0f}), iterations(300)
+// launch configurations found by the autotuner, relative to the working directory like the kernels
+static const char *TUNING_CACHE_FILE = "worksizes.cache";
+
+// formulas of the kernel template and the definitions selecting them
+static const std::map<std::string, std::string> FORMULAS = {
+		{"mandelbrot",       "FORMULA_MANDELBROT"},
+		{"mandelbrot_cubic", "FORMULA_MANDELBROT_CUBIC"},
+		{"burning_ship",     "FORMULA_BURNING_SHIP"},
+		{"tricorn",          "FORMULA_TRICORN"},
+		{"julia_set",        "FORMULA_JULIA"}};
+
+// edge length of the pixel blocks of the persistent kernel, has to match PERSISTENT_BLOCK in the kernel
+static const size_t PERSISTENT_BLOCK = 8;
+// persistent work-groups per compute unit, while one group waits at the barriers around fetching its next block
+// the other one keeps the unit busy, more groups only contend for the block counter
+static const size_t PERSISTENT_GROUPS_PER_UNIT = 2;
+
+// iterations per pass of the wavefront mode before the bounded pixels are compacted
+static const cl_int WAVEFRONT_CHUNK = 128;
+// local size of the one dimensional wavefront kernels
+static const size_t WAVEFRONT_LOCAL = 64;
+// local size of the prefix sum, every work-item scans two elements, has to match SCAN_BLOCK in the kernel
+static const size_t SCAN_BLOCK = 256;
+// bins of the iteration histogram, has to match HISTOGRAM_BINS in the kernel
+static const size_t HISTOGRAM_BINS = 4096;
+// work-groups per compute unit building the histogram, each merges its local histogram once
+static const size_t HISTOGRAM_GROUPS_PER_UNIT = 4;
+static const size_t HISTOGRAM_LOCAL = 256;
+
+// host side layout of the LivePixel struct of the wavefront kernels
+struct LivePixel
+{
+	cl_real2 z;
+	cl_real2 c;
+	cl_int i;
+	cl_uint pixel;
+};
+
+static const size_t RESOLVE_LOCAL = 256;
+// work-groups per compute unit counting the changed pixels, each adds its count once
+static const size_t CHANGE_GROUPS_PER_UNIT = 4;
+static const size_t CHANGE_LOCAL = 256;
+
+// number of uints of the counters buffer, see COUNTERS in the kernel
+static const size_t WORK_COUNTERS = 6;
+
+// orbit density grid over the plane, has to match DENSITY_CELLS in the kernel
+static const size_t DENSITY_CELLS = 512;
+// work-items of a launch of the orbit density mode at most, each with its own random state
+static const size_t DENSITY_ITEMS = 65536;
+static const size_t DENSITY_LOCAL = 256;
+// rounds of DENSITY_BATCH points per work-item and launch
+static const cl_int DENSITY_ROUNDS = 64;
+// the counts of the orbit density mode are printed in this interval
+static const double DENSITY_REPORT_SECONDS = 1.0;
+
+// tiles have TILE_SIZE x TILE_SIZE texels, the tiles of level 0 are TILE_ROOT_EXTENT wide in the complex plane
+static const size_t TILE_SIZE = 256;
+static const double TILE_ROOT_EXTENT = 4.0;
+
+// deep samples are split into launches of about this duration, far below any display driver watchdog
+static const double CHUNK_TARGET_SECONDS = 0.03;
+static const cl_int MIN_ITERATION_CHUNK = 64;
+
+/**
+ * maps the distance d along a Hilbert curve filling an n x n square (n is a power of two) to x and y
+ */
+static void hilbertToXY(size_t n, size_t d, size_t &x, size_t &y)
+{
+	x = y = 0;
+	for (size_t s = 1; s < n; s *= 2)
+	{
+		const size_t rx = 1 & (d / 2);
+		const size_t ry = 1 & (d ^ rx);
+		if (ry == 0)
+		{
+			if (rx == 1)
+			{
+				x = s - 1 - x;
+				y = s - 1 - y;
+			}
+			std::swap(x, y);
+		}
+		x += s * rx;
+		y += s * ry;
+		d /= 4;
+	}
+}
+
+OCLRenderer::OCLRenderer(size_t width, size_t height, size_t gpuNum, const std::string &formula,
+                         const std::string &sourceFilename, cl_uint bailoutUnroll) : texture(Texture(width, height)), zoom(1.0f), pos({0.0f, 0.0f}), color({0.0f, 0.0f, 0.0f}), iterations(300),
+                                                                                     juliaC({-0.53060, -0.50340}), vectorWidth(1), localSizeX(8), localSizeY(8), needsTuning(false),
+                                                                                     renderMode(DIRECT), colorMode(SMOOTH), iterationChunk(1000), stateProgress(0), sampleProgress(0),
+                                                                                     chunkedSampleRunning(false), pixelStateValid(false),
+                                                                                     atlasCapacity(0), mirroring(true),
+                                                                                     workCounters(false), lastWork(), sampleTarget(0), noiseThreshold(0.0),
+                                                                                     noise(1.0), comparedSample(0), importanceSampling(true),
+                                                                                     densityCellsIterations(-1), densityCellCount(0), densityTested(0),
+                                                                                     densityOrbits(0), densityPoints(0)
 {
 	try
 	{
@@ -74,10 +178,14 @@ OCLRenderer::OCLRenderer(size_t width, size_t height, size_t gpuNum, const std::
 							};
 #endif
 							device = d;
+							unifiedMemory = device.getInfo<CL_DEVICE_HOST_UNIFIED_MEMORY>() == CL_TRUE;
 							context = cl::Context(device, properties);
 							queue = cl::CommandQueue(context, device);
+							paletteImage = Palette::createImage(context);
+							uploadPalette();
+							persistentGroups = PERSISTENT_GROUPS_PER_UNIT * device.getInfo<CL_DEVICE_MAX_COMPUTE_UNITS>();
 							// open and compile the program
-							openProgram(sourceFilename, kernelname);
+							openProgram(sourceFilename, formula, bailoutUnroll);
 							// setup texture with the correct width and height
 							reshape(width, height);
 							return;
@@ -99,43 +207,670 @@ OCLRenderer::OCLRenderer(size_t width, size_t height, size_t gpuNum, const std::
 	}
 }
 
-bool OCLRenderer::openProgram(const std::string &filename, const std::string &kernelname)
+bool OCLRenderer::openProgram(const std::string &filename, const std::string &formula, cl_uint bailoutUnroll)
 {
+	if (FORMULAS.find(formula) == FORMULAS.end())
+	{
+		std::cerr << "[OCLRenderer] unknown formula " << formula << std::endl;
+		exit(EXIT_FAILURE);
+	}
 	try
 	{
 		std::ifstream sourcefile(filename);
-		std::string sourcecode(std::istreambuf_iterator<char>(sourcefile), (std::istreambuf_iterator<char>()));
-		cl::Program::Sources source(1, std::make_pair(sourcecode.c_str(), sourcecode.length() + 1));
+		sourceFilename = filename;
+		programSource = std::string(std::istreambuf_iterator<char>(sourcefile), (std::istreambuf_iterator<char>()));
+		OCLRenderer::formula = formula;
+		OCLRenderer::bailoutUnroll = std::max(1u, bailoutUnroll);
+		nextFormula.clear();
+		kernelCompiler.reset();
+		kernelCompiler.reset(new KernelCompiler(context, device, programSource));
 
-		// make program of the source code in the context
-		program = cl::Program(context, source);
+		// reuse the launch configuration of an earlier run, otherwise tune before the first frame
+		TuningCache::Entry entry;
+		if (TuningCache(TUNING_CACHE_FILE).lookup(tuningKey(formula), entry) && buildKernel(entry.vectorWidth) == entry.vectorWidth)
+		{
+			localSizeX = entry.localSizeX;
+			localSizeY = entry.localSizeY;
+			needsTuning = false;
+		}
+		else
+		{
+			buildKernel(preferredVectorWidth());
+			localSizeX = 8;
+			localSizeY = 8;
+			needsTuning = true;
+		}
+		std::cout << "[OCLRenderer] using formula " << formula << " with " << vectorWidth << " pixel(s) per work-item" << std::endl;
+		// the tuning would be disturbed by the compiler
+		if (!needsTuning)
+			precompileFormulas();
+	}
+	catch (cl::Error error)
+	{
+		std::cout << error.what() << "(" << cl::errorString(error.err()) << ")" << std::endl;
 
-		// possibly some definitions for the kernel
-		std::stringstream kerneloptions;
+		if (error.err() == CL_BUILD_PROGRAM_FAILURE)
+			std::cout << "Build log:" << std::endl << program.getBuildInfo<CL_PROGRAM_BUILD_LOG>(device) << std::endl;
 
-		// build program
-		std::vector<cl::Device> tmpdevices;
-		tmpdevices.push_back(device);
-		program.build(tmpdevices, kerneloptions.str().c_str());
+		exit(EXIT_FAILURE);
+	}
+	return true;
+}
 
+std::string OCLRenderer::templateOptions(const std::string &formula, cl_uint bailoutUnroll)
+{
+	auto define = FORMULAS.find(formula);
+	if (define == FORMULAS.end())
+		return "";
+	std::ostringstream options;
+	options << "-D FORMULA=" << define->second << " -D BAILOUT_UNROLL=" << bailoutUnroll;
 #ifdef USE_DOUBLE
-		renderKernelFunc.reset(
-				new cl::make_kernel<cl::ImageGL &, cl::Buffer &, cl::Buffer &, cl_float3, cl_int, cl_int, cl_int, cl_double, cl_double2, cl_int>(
-						cl::Kernel(program, kernelname.c_str())));
+	options << " -D USE_DOUBLE";
+#endif
+	// the escaped pixels of every program are colored through the palette table, so all renderers match
+	options << " -D PALETTE_TABLE";
+	return options.str();
+}
+
+std::vector<std::string> OCLRenderer::formulaNames()
+{
+	std::vector<std::string> names;
+	for (const auto &f : FORMULAS)
+		names.push_back(f.first);
+	return names;
+}
+
+cl_uint OCLRenderer::preferredVectorWidth() const
+{
+#ifdef USE_DOUBLE
+	cl_uint preferredWidth = device.getInfo<CL_DEVICE_PREFERRED_VECTOR_WIDTH_DOUBLE>();
 #else
-		renderKernelFunc.reset(
-				new cl::make_kernel<cl::ImageGL &, cl::Buffer &, cl::Buffer &, cl_float3, cl_int, cl_int, cl_int, cl_float, cl_float2, cl_int>(
-						cl::Kernel(program, "mandelbrot")));
+	cl_uint preferredWidth = device.getInfo<CL_DEVICE_PREFERRED_VECTOR_WIDTH_FLOAT>();
+#endif
+	return preferredWidth > 1 ? std::min(16u, cl::nextPowOfTwo(preferredWidth)) : 1;
+}
+
+std::string OCLRenderer::kernelOptions(const std::string &formula, cl_uint width) const
+{
+	// definitions specializing the kernel template
+	std::stringstream kerneloptions;
+	kerneloptions << templateOptions(formula, bailoutUnroll);
+	if (colorMode == HISTOGRAM)
+		kerneloptions << " -D HISTOGRAM_COLORING";
+	// the vectorized kernel computes a strip of width pixels per work-item
+	if (width > 1)
+		kerneloptions << " -D VEC_WIDTH=" << width;
+	if (workCounters)
+		kerneloptions << " -D WORK_COUNTERS";
+	return kerneloptions.str();
+}
+
+cl_uint OCLRenderer::buildKernel(cl_uint width)
+{
+	// the compiler keeps the built variants, switching back to one of them doesn't build it again
+	vectorWidth = width;
+	bool built;
+	program = kernelCompiler->get(kernelOptions(formula, width), built);
+	if (!built)
+		throw cl::Error(CL_BUILD_PROGRAM_FAILURE, "clBuildProgram");
+
+	if (vectorWidth > 1)
+	{
+		try
+		{
+			renderKernel = cl::Kernel(program, "fractal_vec");
+		}
+		catch (cl::Error error)
+		{
+			// there is no vectorized variant of this kernel, fall back to one pixel per work-item
+			if (error.err() != CL_INVALID_KERNEL_NAME)
+				throw;
+			vectorWidth = 1;
+		}
+	}
+	if (vectorWidth == 1)
+		renderKernel = cl::Kernel(program, "fractal");
+
+	// the counters are an additional last argument of the render kernels, it is set once here and
+	// stays set, since the functors only set the arguments before it
+	auto counted = [this](cl::Kernel kernel)
+	{
+		if (workCounters)
+			kernel.setArg(kernel.getInfo<CL_KERNEL_NUM_ARGS>() - 1, countersBuffer);
+		return kernel;
+	};
+	// the palette comes before the counters in the kernels that color
+	auto paletted = [this](cl::Kernel kernel, bool hasCounters)
+	{
+		kernel.setArg(kernel.getInfo<CL_KERNEL_NUM_ARGS>() - (hasCounters && workCounters ? 2 : 1), paletteImage);
+		return kernel;
+	};
+	counted(paletted(renderKernel, true));
+
+	renderKernelFunc.reset(
+			new cl::make_kernel<cl::ImageGL &, cl::Buffer &, cl::Buffer &, cl::Buffer &, cl::Buffer &, cl_float3, cl_int, cl_int, cl_int, cl_real, cl_real2, cl_int, cl_real2>(renderKernel));
+	mirroredKernelFunc.reset(
+			new cl::make_kernel<cl::ImageGL &, cl::Buffer &, cl::Buffer &, cl::Buffer &, cl::Buffer &, cl_float3, cl_int, cl_int, cl_int, cl_real, cl_real2, cl_int, cl_real2,
+					cl_int, cl_int, cl_int>(counted(paletted(cl::Kernel(program, "fractal_mirrored"), true))));
+	// a block per work-group, unless the device allows less work-items for the built kernel
+	cl::Kernel persistentKernel(program, "fractal_persistent");
+	persistentLocal = std::min(PERSISTENT_BLOCK * PERSISTENT_BLOCK, persistentKernel.getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(device));
+	persistentKernelFunc.reset(
+			new cl::make_kernel<cl::ImageGL &, cl::Buffer &, cl::Buffer &, cl::Buffer &, cl::Buffer &, cl_float3, cl_int, cl_int, cl_int, cl_real, cl_real2, cl_int, cl_real2,
+					cl::Buffer &, cl::Buffer &, cl_uint>(counted(paletted(persistentKernel, true))));
+	wavefrontStartFunc.reset(new cl::make_kernel<cl::Buffer &, cl::Buffer &, cl_int, cl_int, cl_real, cl_real2, cl_real2>(
+			cl::Kernel(program, "wavefront_start")));
+	wavefrontIterateFunc.reset(new cl::make_kernel<cl::ImageGL &, cl::Buffer &, cl::Buffer &, cl::Buffer &, cl::Buffer &, cl::Buffer &, cl_float3, cl_int, cl_uint, cl_int, cl_int, cl_int>(
+			counted(paletted(cl::Kernel(program, "wavefront_iterate"), true))));
+	wavefrontCompactFunc.reset(new cl::make_kernel<cl::Buffer &, cl::Buffer &, cl::Buffer &, cl::Buffer &, cl::Buffer &, cl_uint>(
+			cl::Kernel(program, "wavefront_compact")));
+	tileRenderFunc.reset(new cl::make_kernel<cl::Buffer &, cl::Buffer &, cl_real2, cl_real, cl_int, cl_real2>(cl::Kernel(program, "tile_render")));
+	tileComposeFunc.reset(new cl::make_kernel<cl::ImageGL &, cl::Buffer &, cl::Buffer &, cl::Buffer &, cl_float3, cl_int, cl_int, cl_real, cl_real2, cl_real2, cl_real, cl_int, cl_int>(
+			paletted(cl::Kernel(program, "tile_compose"), false)));
+	exportFieldFunc.reset(new cl::make_kernel<cl::Buffer &, cl::Buffer &, cl_int, cl_int, cl_int, cl_int, cl_int>(cl::Kernel(program, "export_field")));
+	exportFieldHalfFunc.reset(new cl::make_kernel<cl::Buffer &, cl::Buffer &, cl_int, cl_int, cl_int, cl_int, cl_int>(
+			cl::Kernel(program, "export_field_half")));
+	resolveFunc.reset(new cl::make_kernel<cl::Buffer &, cl::Buffer &, cl_int, cl_uint, cl_int>(cl::Kernel(program, "resolve")));
+	sampleChangeFunc.reset(new cl::make_kernel<cl::Buffer &, cl::Buffer &, cl::Buffer &, cl_int, cl_uint>(cl::Kernel(program, "sample_change")));
+	histogramRangeFunc.reset(new cl::make_kernel<cl::Buffer &, cl::Buffer &, cl_uint>(cl::Kernel(program, "histogram_range")));
+	histogramBuildFunc.reset(new cl::make_kernel<cl::Buffer &, cl::Buffer &, cl_uint, cl::Buffer &>(cl::Kernel(program, "histogram_build")));
+	histogramColorFunc.reset(new cl::make_kernel<cl::ImageGL &, cl::Buffer &, cl::Buffer &, cl::Buffer &, cl::Buffer &, cl_float3, cl_int, cl_int, cl::Buffer &, cl_int>(
+			paletted(cl::Kernel(program, "histogram_color"), false)));
+	densityCellsFunc.reset(new cl::make_kernel<cl::Buffer &, cl_int, cl_real2>(cl::Kernel(program, "density_cells")));
+	densitySplatFunc.reset(new cl::make_kernel<cl::Buffer &, cl::Buffer &, cl::Buffer &, cl_uint, cl::Buffer &, cl_int, cl_int, cl_int, cl_real, cl_real2, cl_int, cl_real2>(
+			cl::Kernel(program, "density_splat")));
+	densityMaxFunc.reset(new cl::make_kernel<cl::Buffer &, cl::Buffer &, cl_uint>(cl::Kernel(program, "density_max")));
+	densityColorFunc.reset(new cl::make_kernel<cl::ImageGL &, cl::Buffer &, cl::Buffer &, cl::Buffer &, cl_float3, cl_int, cl_int, cl_int>(
+			paletted(cl::Kernel(program, "density_color"), false)));
+	// another formula invalidates the stored orbits and the boundary cells
+	pixelStateValid = false;
+	densityCellsIterations = -1;
+	chunkIterateFunc.reset(new cl::make_kernel<cl::ImageGL &, cl::Buffer &, cl::Buffer &, cl::Buffer &, cl_float3, cl_int, cl_int, cl_int, cl_int, cl_int, cl_int, cl_int>(
+			counted(paletted(cl::Kernel(program, "chunk_iterate"), true))));
+	scanBlocksFunc.reset(new cl::make_kernel<cl::Buffer &, cl::Buffer &, cl::Buffer &, cl_uint>(cl::Kernel(program, "scan_blocks")));
+	scanAddFunc.reset(new cl::make_kernel<cl::Buffer &, cl::Buffer &, cl_uint>(cl::Kernel(program, "scan_add")));
+	return vectorWidth;
+}
+
+std::string OCLRenderer::tuningKey(const std::string &formula) const
+{
+	std::ostringstream key;
+	key << device.getInfo<CL_DEVICE_NAME>() << " (" << device.getInfo<CL_DRIVER_VERSION>() << ") " << sourceFilename << ":" << formula << " unroll " << bailoutUnroll;
+#ifdef USE_DOUBLE
+	key << " double";
 #endif
+	return key.str();
+}
+
+void OCLRenderer::tune()
+{
+	needsTuning = false;
+	std::cout << "[OCLRenderer] tuning work-group size for " << device.getInfo<CL_DEVICE_NAME>() << ", this is done only once" << std::endl;
+
+	// benchmark at the initial overview, which is a representative mix of cheap and expensive pixels
+	const cl_double oldZoom = zoom;
+	const cl_double2 oldPos = pos;
+	const cl_int oldIterations = iterations;
+	const RenderMode oldRenderMode = renderMode;
+	const cl_int oldIterationChunk = iterationChunk;
+	const bool oldMirroring = mirroring;
+	renderMode = DIRECT;
+	// the vector widths are compared on the full image
+	mirroring = false;
+	iterationChunk = std::numeric_limits<cl_int>::max();
+	zoom = 4.0;
+	pos = {-1.2 / 4.0 * texture.width / texture.height, -1.2 / 4.0};
+	iterations = 300;
+
+	std::vector<cl_uint> widths(1, 1);
+	if (preferredVectorWidth() > 1)
+		widths.push_back(preferredVectorWidth());
+
+	const std::vector<size_t> maxItemSizes = device.getInfo<CL_DEVICE_MAX_WORK_ITEM_SIZES>();
+	TuningCache::Entry best = {vectorWidth, localSizeX, localSizeY};
+	double bestTime = std::numeric_limits<double>::max();
+	for (cl_uint width : widths)
+	{
+		if (buildKernel(width) != width)
+			continue;
+		const size_t multiple = renderKernel.getWorkGroupInfo<CL_KERNEL_PREFERRED_WORK_GROUP_SIZE_MULTIPLE>(device);
+		const size_t maxSize = std::min((size_t) 512, renderKernel.getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(device));
+
+		// work-group sizes are multiples of the preferred multiple, shapes are at most 16 times wider than high
+		for (size_t total = multiple; total <= maxSize; total *= 2)
+		{
+			if (total < 8)
+				continue;
+			for (size_t x = 1; x <= total; x *= 2)
+			{
+				const size_t y = total / x;
+				if (total % x || x * 4 < y || x > y * 16 || x > maxItemSizes[0] || y > maxItemSizes[1])
+					continue;
+				localSizeX = x;
+				localSizeY = y;
+				try
+				{
+					// the first launch is a warm-up, the fastest of the following ones counts
+					launch(true, false);
+					double time = std::numeric_limits<double>::max();
+					for (int run = 0; run < 3; ++run)
+					{
+						auto start = std::chrono::steady_clock::now();
+						launch(true, false);
+						time = std::min(time, std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+					}
+					if (time < bestTime)
+					{
+						bestTime = time;
+						best = {width, x, y};
+					}
+				}
+				catch (cl::Error error)
+				{
+					// the device refused this configuration, try the next one
+					queue.enqueueReleaseGLObjects(&glObjs);
+					queue.finish();
+				}
+			}
+		}
 	}
-	catch (cl::Error error)
+
+	buildKernel(best.vectorWidth);
+	localSizeX = best.localSizeX;
+	localSizeY = best.localSizeY;
+	if (bestTime < std::numeric_limits<double>::max())
 	{
-		std::cout << error.what() << "(" << cl::errorString(error.err()) << ")" << std::endl;
+		TuningCache(TUNING_CACHE_FILE).store(tuningKey(formula), best);
+		std::cout << "[OCLRenderer] fastest configuration: " << vectorWidth << " pixel(s) per work-item, local size " <<
+		localSizeX << "x" << localSizeY << " (" << bestTime * 1000.0 << "ms)" << std::endl;
+	}
+	else
+	{
+		// nothing was measured, the defaults are kept and tuned again on the next start
+		std::cerr << "[OCLRenderer] no configuration could be benchmarked, keeping " << vectorWidth << " pixel(s) per work-item, local size " <<
+		localSizeX << "x" << localSizeY << std::endl;
+	}
+
+	zoom = oldZoom;
+	pos = oldPos;
+	iterations = oldIterations;
+	renderMode = oldRenderMode;
+	iterationChunk = oldIterationChunk;
+	mirroring = oldMirroring;
+	precompileFormulas();
+}
+
+void OCLRenderer::precompileFormulas()
+{
+	TuningCache tuningCache(TUNING_CACHE_FILE);
+	for (const auto &f : FORMULAS)
+	{
+		TuningCache::Entry entry = {vectorWidth, localSizeX, localSizeY};
+		tuningCache.lookup(tuningKey(f.first), entry);
+		kernelCompiler->request(kernelOptions(f.first, entry.vectorWidth));
+	}
+}
 
+bool OCLRenderer::swapFormula()
+{
+	if (nextFormula.empty())
+		return false;
+	// the other build options may have changed since the formula was selected, that variant is requested instead
+	const std::string options = kernelOptions(nextFormula, nextConfiguration.vectorWidth);
+	kernelCompiler->request(options, true);
+	if (!kernelCompiler->isReady(options))
+		return false;
+
+	const std::string previousFormula = formula;
+	const cl_uint previousWidth = vectorWidth;
+	formula = nextFormula;
+	nextFormula.clear();
+	try
+	{
+		buildKernel(nextConfiguration.vectorWidth);
+		localSizeX = nextConfiguration.localSizeX;
+		localSizeY = nextConfiguration.localSizeY;
+	}
+	catch (cl::Error error)
+	{
+		std::cerr << "[OCLRenderer] couldn't switch to formula " << formula << ": " << error.what() << "(" << cl::errorString(error.err()) << ")" << std::endl;
 		if (error.err() == CL_BUILD_PROGRAM_FAILURE)
 			std::cout << "Build log:" << std::endl << program.getBuildInfo<CL_PROGRAM_BUILD_LOG>(device) << std::endl;
+		// the previous variant is still built, so this doesn't compile anything
+		formula = previousFormula;
+		buildKernel(previousWidth);
+		return false;
+	}
+	std::cout << "[OCLRenderer] switched to formula " << formula << " with " << vectorWidth << " pixel(s) per work-item" << std::endl;
+	return true;
+}
 
-		exit(EXIT_FAILURE);
+void OCLRenderer::scan(cl::Buffer &in, cl::Buffer &out, cl_uint n, size_t level)
+{
+	const size_t groups = (n + 2 * SCAN_BLOCK - 1) / (2 * SCAN_BLOCK);
+	(*scanBlocksFunc)(cl::EnqueueArgs(queue, cl::NDRange(groups * SCAN_BLOCK), cl::NDRange(SCAN_BLOCK)), in, out, scanSumsBuffers[level], n);
+	if (groups > 1)
+	{
+		scan(scanSumsBuffers[level], scanSumsBuffers[level], groups, level + 1);
+		(*scanAddFunc)(cl::EnqueueArgs(queue, cl::NDRange(groups * 2 * SCAN_BLOCK), cl::NDRange(SCAN_BLOCK)), out, scanSumsBuffers[level], n);
+	}
+}
+
+bool OCLRenderer::stateMatchesView() const
+{
+	const cl_double2 position = samplePos();
+	return pixelStateValid && zoom == stateZoom && position.s[0] == statePos.s[0] && position.s[1] == statePos.s[1] &&
+	       juliaC.s[0] == stateJuliaC.s[0] && juliaC.s[1] == stateJuliaC.s[1];
+}
+
+void OCLRenderer::composeTiles()
+{
+	// the coarsest level whose texels aren't larger than the pixels of the view, so a tile covers
+	// between TILE_SIZE / 2 and TILE_SIZE pixels
+	const int level = (int) std::ceil(std::log2(TILE_ROOT_EXTENT * texture.width / (TILE_SIZE * zoom)));
+	const double extent = std::ldexp(TILE_ROOT_EXTENT, -level);
+	const cl_double2 position = samplePos();
+	const long long x0 = (long long) std::floor(zoom * position.s[0] / extent);
+	const long long y0 = (long long) std::floor(zoom * position.s[1] / extent);
+	const int gridWidth = (int) ((long long) std::floor(zoom * (1.0 + position.s[0]) / extent) - x0 + 1);
+	const int gridHeight = (int) ((long long) std::floor(zoom * ((double) texture.height / texture.width + position.s[1]) / extent) - y0 + 1);
+	const size_t tileBytes = TILE_SIZE * TILE_SIZE * sizeof(cl_float);
+	if ((size_t) (gridWidth * gridHeight) > atlasCapacity)
+	{
+		atlasCapacity = gridWidth * gridHeight;
+		atlasBuffer = cl::Buffer(context, CL_MEM_READ_WRITE, atlasCapacity * tileBytes);
+		tileJobsBuffer = cl::Buffer(context, CL_MEM_READ_ONLY, atlasCapacity * sizeof(cl_long4));
+	}
+
+	std::ostringstream fractal;
+	fractal << formula;
+	if (formula == "julia_set")
+	{
+		fractal.precision(17);
+		fractal << " " << juliaC.s[0] << " " << juliaC.s[1];
+	}
+
+	// cached tiles are uploaded right away, the pointers are only valid until the next lookup
+	std::vector<TileCache::Key> missingKeys;
+	std::vector<cl_long4> missingJobs;
+	for (int y = 0; y < gridHeight; ++y)
+	{
+		for (int x = 0; x < gridWidth; ++x)
+		{
+			const TileCache::Key key = {level, x0 + x, y0 + y, iterations, fractal.str()};
+			const cl_uint slot = y * gridWidth + x;
+			const std::vector<float> *data = tileCache->lookup(key);
+			if (data)
+				queue.enqueueWriteBuffer(atlasBuffer, CL_TRUE, slot * tileBytes, tileBytes, data->data());
+			else
+			{
+				missingKeys.push_back(key);
+				missingJobs.push_back({(cl_long) key.x, (cl_long) key.y, level, slot});
+			}
+		}
+	}
+
+	cl_real2 juliaCr = {(cl_real) juliaC.s[0], (cl_real) juliaC.s[1]};
+	if (!missingJobs.empty())
+	{
+		queue.enqueueWriteBuffer(tileJobsBuffer, CL_FALSE, 0, missingJobs.size() * sizeof(cl_long4), missingJobs.data());
+		cl_real2 origin = {0.0, 0.0};
+		(*tileRenderFunc)(cl::EnqueueArgs(queue, cl::NDRange(TILE_SIZE, TILE_SIZE, missingJobs.size())), atlasBuffer, tileJobsBuffer,
+		                  origin, (cl_real) TILE_ROOT_EXTENT, iterations, juliaCr);
+	}
+
+	cl_real2 posr = {(cl_real) position.s[0], (cl_real) position.s[1]};
+	cl_real2 gridOrigin = {(cl_real) (x0 * extent), (cl_real) (y0 * extent)};
+	(*tileComposeFunc)(cl::EnqueueArgs(queue, cl::NDRange(cl::nextDivisible(texture.width, localSizeX), cl::nextDivisible(texture.height, localSizeY)),
+	                                   cl::NDRange(localSizeX, localSizeY)),
+	                   imageBuffer, imageRawBuffer, smoothIterationsBuffer, atlasBuffer, color, texture.width, texture.height, (cl_real) zoom,
+	                   posr, gridOrigin, (cl_real) extent, gridWidth, gridHeight);
+
+	for (size_t i = 0; i < missingKeys.size(); ++i)
+	{
+		std::vector<float> data(TILE_SIZE * TILE_SIZE);
+		queue.enqueueReadBuffer(atlasBuffer, CL_TRUE, missingJobs[i].s[3] * tileBytes, tileBytes, data.data());
+		tileCache->store(missingKeys[i], std::move(data));
+	}
+}
+
+void OCLRenderer::findDensityCells()
+{
+	cl::Buffer boundaryBuffer(context, CL_MEM_WRITE_ONLY, DENSITY_CELLS * DENSITY_CELLS);
+	cl_real2 juliaCr = {(cl_real) juliaC.s[0], (cl_real) juliaC.s[1]};
+	(*densityCellsFunc)(cl::EnqueueArgs(queue, cl::NDRange(cl::nextDivisible(DENSITY_CELLS, localSizeX), cl::nextDivisible(DENSITY_CELLS, localSizeY)),
+	                                    cl::NDRange(localSizeX, localSizeY)), boundaryBuffer, iterations, juliaCr);
+	std::vector<cl_uchar> boundary(DENSITY_CELLS * DENSITY_CELLS);
+	queue.enqueueReadBuffer(boundaryBuffer, CL_TRUE, 0, boundary.size(), boundary.data());
+
+	std::vector<cl_uint> cells;
+	for (size_t y = 0; y < DENSITY_CELLS; ++y)
+		for (size_t x = 0; x < DENSITY_CELLS; ++x)
+		{
+			bool nearBoundary = false;
+			for (size_t ny = std::max(y, (size_t) 1) - 1; ny <= std::min(y + 1, DENSITY_CELLS - 1) && !nearBoundary; ++ny)
+				for (size_t nx = std::max(x, (size_t) 1) - 1; nx <= std::min(x + 1, DENSITY_CELLS - 1) && !nearBoundary; ++nx)
+					nearBoundary = boundary[ny * DENSITY_CELLS + nx] != 0;
+			if (nearBoundary)
+				cells.push_back((cl_uint) (y * DENSITY_CELLS + x));
+		}
+	densityCellCount = cells.size();
+	if (densityCellCount)
+		queue.enqueueWriteBuffer(densityCellsBuffer, CL_TRUE, 0, cells.size() * sizeof(cl_uint), cells.data());
+	densityCellsIterations = iterations;
+}
+
+void OCLRenderer::renderDensity(bool refresh)
+{
+	if (importanceSampling && densityCellsIterations != iterations)
+		findDensityCells();
+	if (refresh)
+	{
+		queue.enqueueFillBuffer(densityBuffer, (cl_uint) 0, 0, texture.width * texture.height * sizeof(cl_uint));
+		densityReportStart = std::chrono::steady_clock::now();
+		densityTested = densityOrbits = densityPoints = 0;
+	}
+	const cl_uint zeros[4] = {0, 0, 0, 0};
+	queue.enqueueWriteBuffer(densityStatsBuffer, CL_FALSE, 0, sizeof(zeros), zeros);
+
+	// every work-item continues its own random sequence, so there can't be more than pixels
+	const size_t items = std::min(DENSITY_ITEMS, texture.width * texture.height / DENSITY_LOCAL * DENSITY_LOCAL);
+	cl_real2 posr = {(cl_real) pos.s[0], (cl_real) pos.s[1]};
+	cl_real2 juliaCr = {(cl_real) juliaC.s[0], (cl_real) juliaC.s[1]};
+	if (items)
+		(*densitySplatFunc)(cl::EnqueueArgs(queue, cl::NDRange(items), cl::NDRange(DENSITY_LOCAL)), densityBuffer, randStatesBuffer,
+		                    densityCellsBuffer, importanceSampling ? densityCellCount : 0, densityStatsBuffer, texture.width,
+		                    texture.height, iterations, (cl_real) zoom, posr, DENSITY_ROUNDS, juliaCr);
+	const size_t groups = HISTOGRAM_GROUPS_PER_UNIT * device.getInfo<CL_DEVICE_MAX_COMPUTE_UNITS>();
+	(*densityMaxFunc)(cl::EnqueueArgs(queue, cl::NDRange(groups * DENSITY_LOCAL), cl::NDRange(DENSITY_LOCAL)), densityBuffer,
+	                  densityStatsBuffer, texture.width * texture.height);
+	(*densityColorFunc)(cl::EnqueueArgs(queue, cl::NDRange(cl::nextDivisible(texture.width, localSizeX), cl::nextDivisible(texture.height, localSizeY)),
+	                                    cl::NDRange(localSizeX, localSizeY)),
+	                    imageBuffer, imageRawBuffer, densityBuffer, densityStatsBuffer, color, texture.width, texture.height, sampleCount);
+
+	cl_uint stats[4];
+	queue.enqueueReadBuffer(densityStatsBuffer, CL_TRUE, 0, sizeof(stats), stats);
+	densityTested += stats[0];
+	densityOrbits += stats[1];
+	densityPoints += stats[2];
+	const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - densityReportStart).count();
+	if (seconds >= DENSITY_REPORT_SECONDS)
+	{
+		std::cout << "[OCLRenderer] orbit density: " << densityOrbits / seconds << " orbits/s, " << densityPoints / seconds <<
+		" points/s, " << (densityTested ? 100.0 * densityOrbits / densityTested : 0.0) << "% of the c escaped" << std::endl;
+		densityReportStart = std::chrono::steady_clock::now();
+		densityTested = densityOrbits = densityPoints = 0;
+	}
+}
+
+void OCLRenderer::launch(bool refresh, bool allowResume)
+{
+	queue.enqueueAcquireGLObjects(&glObjs);
+	const auto start = std::chrono::steady_clock::now();
+	if (workCounters)
+	{
+		const cl_uint initial[WORK_COUNTERS] = {0, 0, 0, 0, std::numeric_limits<cl_uint>::max(), 0};
+		queue.enqueueWriteBuffer(countersBuffer, CL_FALSE, 0, sizeof(initial), initial);
+	}
+	// pixels that escaped below the old limit can't change, only the bounded ones are iterated further
+	const bool density = renderMode == DENSITY;
+	const bool resume = !density && refresh && allowResume && stateMatchesView() && iterations >= stateProgress;
+	const bool continueSample = chunkedSampleRunning && !refresh;
+	if (!continueSample)
+		sampleCount = refresh ? 1 : (sampleCount + 1);
+	chunkedSampleRunning = false;
+	// iterations the pixels advanced at most in this launch
+	cl_int launchIterations = iterations;
+	const cl_double2 position = samplePos();
+	cl_real2 posr = {(cl_real) position.s[0], (cl_real) position.s[1]};
+	cl_real2 juliaCr = {(cl_real) juliaC.s[0], (cl_real) juliaC.s[1]};
+	// missing tiles are rendered in one launch, deeper views are chunked instead so the watchdog never fires
+	const bool composed = !density && refresh && allowResume && !resume && tileCache && iterations <= iterationChunk;
+	const bool chunked = !density && !composed && (resume || continueSample || (renderMode != WAVEFRONT && iterations > iterationChunk));
+	// twice the row of the real axis, the rows y and axisRows - 1 - y mirror each other. The rows
+	// [skipFrom, skipTo) are the smaller half of the rows whose mirror is inside the image
+	const cl_int axisRows = (cl_int) std::max(-1.0, std::min(2.0 * texture.height + 1.0, std::round(-2.0 * position.s[1] * texture.width)));
+	const cl_int skipFrom = std::max(axisRows - (cl_int) texture.height, (axisRows + 1) / 2);
+	const cl_int skipTo = std::min((cl_int) texture.height, axisRows);
+	const bool mirrored = mirroring && renderMode == DIRECT && vectorWidth == 1 && isSymmetric() && skipFrom < skipTo;
+	if (density)
+		renderDensity(refresh);
+	else if (composed)
+		composeTiles();
+	else if (chunked)
+	{
+		// too deep for a single launch or continued from the stored state, every render call advances the sample by one chunk
+		cl::EnqueueArgs eargs(queue, cl::NDRange(cl::nextDivisible(texture.width, localSizeX), cl::nextDivisible(texture.height, localSizeY)),
+		                      cl::NDRange(localSizeX, localSizeY));
+		// only the first sample keeps its state for the export and raised limits, the later ones iterate in a scratch buffer
+		cl::Buffer &chunkState = sampleCount == 1 ? pixelStateBuffer : liveBuffers[0];
+		if (resume)
+			sampleProgress = stateProgress;
+		else if (!continueSample)
+		{
+			(*wavefrontStartFunc)(eargs, chunkState, randStatesBuffer, texture.width, texture.height, (cl_real) zoom, posr, juliaCr);
+			sampleProgress = 0;
+		}
+		launchIterations = std::max(0, std::min(iterationChunk, iterations - sampleProgress));
+		(*chunkIterateFunc)(eargs, imageBuffer, imageRawBuffer, smoothIterationsBuffer, chunkState, color, texture.width,
+		                    texture.height, iterations, sampleProgress, launchIterations, resume ? 1 : 0, sampleCount);
+		sampleProgress += launchIterations;
+		if (sampleCount == 1)
+			stateProgress = sampleProgress;
+		chunkedSampleRunning = sampleProgress < iterations;
+	}
+	else if (renderMode == PERSISTENT)
+	{
+		const cl_uint zero = 0;
+		queue.enqueueWriteBuffer(blockCounterBuffer, CL_FALSE, 0, sizeof(cl_uint), &zero);
+		cl::EnqueueArgs eargs(queue, cl::NDRange(persistentGroups * persistentLocal), cl::NDRange(persistentLocal));
+		(*persistentKernelFunc)(eargs, imageBuffer, imageRawBuffer, smoothIterationsBuffer, randStatesBuffer, pixelStateBuffer, color, texture.width,
+		                        texture.height, iterations, (cl_real) zoom, posr, sampleCount, juliaCr,
+		                        blockCounterBuffer, blockOrderBuffer, blockCount);
+	}
+	else if (renderMode == WAVEFRONT)
+	{
+		(*wavefrontStartFunc)(cl::EnqueueArgs(queue, cl::NDRange(cl::nextDivisible(texture.width, localSizeX), cl::nextDivisible(texture.height, localSizeY)),
+		                                      cl::NDRange(localSizeX, localSizeY)),
+		                      liveBuffers[0], randStatesBuffer, texture.width, texture.height, (cl_real) zoom, posr, juliaCr);
+		// every pass finishes the pixels that escape or reach the iteration limit and compacts the rest for the next one
+		cl_uint count = texture.width * texture.height;
+		for (size_t pass = 0; count > 0; ++pass)
+		{
+			cl::Buffer &live = liveBuffers[pass % 2];
+			cl::EnqueueArgs eargs(queue, cl::NDRange(cl::nextDivisible(count, WAVEFRONT_LOCAL)), cl::NDRange(WAVEFRONT_LOCAL));
+			(*wavefrontIterateFunc)(eargs, imageBuffer, imageRawBuffer, smoothIterationsBuffer, live, aliveBuffer, pixelStateBuffer, color, texture.width, count, iterations,
+			                        WAVEFRONT_CHUNK, sampleCount);
+			scan(aliveBuffer, offsetsBuffer, count);
+			(*wavefrontCompactFunc)(eargs, live, liveBuffers[(pass + 1) % 2], aliveBuffer, offsetsBuffer, liveCountBuffer, count);
+			queue.enqueueReadBuffer(liveCountBuffer, CL_TRUE, 0, sizeof(cl_uint), &count);
+		}
+	}
+	else if (mirrored)
+	{
+		cl::EnqueueArgs eargs(queue, cl::NDRange(cl::nextDivisible(texture.width, localSizeX), cl::nextDivisible(texture.height - (skipTo - skipFrom), localSizeY)),
+		                      cl::NDRange(localSizeX, localSizeY));
+		(*mirroredKernelFunc)(eargs, imageBuffer, imageRawBuffer, smoothIterationsBuffer, randStatesBuffer, pixelStateBuffer, color, texture.width,
+		                      texture.height, iterations, (cl_real) zoom, posr, sampleCount, juliaCr, axisRows, skipFrom, skipTo);
+	}
+	else
+	{
+		cl::EnqueueArgs eargs(queue, cl::NDRange(cl::nextDivisible((texture.width + vectorWidth - 1) / vectorWidth, localSizeX),
+		                                         cl::nextDivisible(texture.height, localSizeY)), cl::NDRange(localSizeX, localSizeY));
+		(*renderKernelFunc)(eargs, imageBuffer, imageRawBuffer, smoothIterationsBuffer, randStatesBuffer, pixelStateBuffer, color, texture.width,
+		                    texture.height, iterations, (cl_real) zoom, posr, sampleCount, juliaCr);
+	}
+	if (sampleCount == 1 && !composed && !density)
+	{
+		// the other modes store the final orbits of the first sample
+		if (!chunked)
+			stateProgress = iterations;
+		pixelStateValid = true;
+		stateZoom = zoom;
+		statePos = position;
+		stateJuliaC = juliaC;
+	}
+
+	if (colorMode == HISTOGRAM && !chunkedSampleRunning && !density)
+	{
+		// the kernels above only stored the smooth iteration counts, color them through the CDF of their histogram
+		const size_t groups = HISTOGRAM_GROUPS_PER_UNIT * device.getInfo<CL_DEVICE_MAX_COMPUTE_UNITS>();
+		cl::EnqueueArgs histogramArgs(queue, cl::NDRange(groups * HISTOGRAM_LOCAL), cl::NDRange(HISTOGRAM_LOCAL));
+		const cl_uint2 emptyRange = {{std::numeric_limits<cl_uint>::max(), 0}};
+		queue.enqueueFillBuffer(histogramRangeBuffer, emptyRange, 0, sizeof(emptyRange));
+		(*histogramRangeFunc)(histogramArgs, smoothIterationsBuffer, histogramRangeBuffer, texture.width * texture.height);
+		queue.enqueueFillBuffer(histogramBuffer, (cl_uint) 0, 0, HISTOGRAM_BINS * sizeof(cl_uint));
+		(*histogramBuildFunc)(histogramArgs, smoothIterationsBuffer, histogramBuffer, texture.width * texture.height, histogramRangeBuffer);
+		scan(histogramBuffer, cdfBuffer, HISTOGRAM_BINS);
+		(*histogramColorFunc)(cl::EnqueueArgs(queue, cl::NDRange(cl::nextDivisible(texture.width, localSizeX), cl::nextDivisible(texture.height, localSizeY)),
+		                                      cl::NDRange(localSizeX, localSizeY)),
+		                      imageBuffer, imageRawBuffer, smoothIterationsBuffer, histogramBuffer, cdfBuffer, color, texture.width,
+		                      texture.height, histogramRangeBuffer, sampleCount);
+	}
+	// compare a finished sample with the previous one, which is only possible if that one was kept
+	const bool measure = noiseThreshold > 0.0 && !chunkedSampleRunning;
+	if (measure)
+	{
+		const cl_uint zero = 0;
+		queue.enqueueWriteBuffer(changedBuffer, CL_FALSE, 0, sizeof(cl_uint), &zero);
+		const size_t groups = CHANGE_GROUPS_PER_UNIT * device.getInfo<CL_DEVICE_MAX_COMPUTE_UNITS>();
+		(*sampleChangeFunc)(cl::EnqueueArgs(queue, cl::NDRange(groups * CHANGE_LOCAL), cl::NDRange(CHANGE_LOCAL)), imageRawBuffer,
+		                    previousRawBuffer, changedBuffer, comparedSample == sampleCount - 1 ? sampleCount : 1,
+		                    texture.width * texture.height);
+	}
+	queue.enqueueReleaseGLObjects(&glObjs);
+	queue.finish();
+	if (measure)
+	{
+		cl_uint changed;
+		queue.enqueueReadBuffer(changedBuffer, CL_TRUE, 0, sizeof(cl_uint), &changed);
+		noise = comparedSample == sampleCount - 1 ? (double) changed / (texture.width * texture.height) : 1.0;
+		comparedSample = sampleCount;
+	}
+	else if (!chunkedSampleRunning)
+	{
+		noise = 1.0;
+		comparedSample = 0;
+	}
+	if (workCounters)
+	{
+		cl_uint counters[WORK_COUNTERS];
+		queue.enqueueReadBuffer(countersBuffer, CL_TRUE, 0, sizeof(counters), counters);
+		lastWork.iterations = ((cl_ulong) counters[1] << 32) | counters[0];
+		lastWork.escaped = counters[2];
+		lastWork.interior = counters[3];
+		lastWork.minEscape = counters[4];
+		lastWork.maxEscape = counters[5];
+		lastWork.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	}
+
+	// the first launch of a sample has the most pixels to iterate, estimate from it how many iterations
+	// fit into CHUNK_TARGET_SECONDS. The growth is limited, since the cost per iteration isn't linear
+	if (!continueSample && !resume && !composed && renderMode != WAVEFRONT && !density)
+	{
+		const double seconds = std::max(1e-4, std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+		const double estimate = launchIterations * CHUNK_TARGET_SECONDS / seconds;
+		iterationChunk = (cl_int) std::max((double) MIN_ITERATION_CHUNK, std::min(2.0 * iterationChunk, estimate));
 	}
 }
 
@@ -144,20 +879,20 @@ void OCLRenderer::render(bool refresh)
 	glFinish();
 	try
 	{
-		queue.enqueueAcquireGLObjects(&glObjs);
-		cl::EnqueueArgs eargs(queue, cl::NDRange(cl::nextDivisible(texture.width, 8),
-		                                         cl::nextDivisible(texture.height, 8)), cl::NDRange(8, 8));
-		sampleCount = refresh ? 1 : (sampleCount + 1);
-#ifdef USE_DOUBLE
-		(*renderKernelFunc)(eargs, imageBuffer, imageRawBuffer, randStatesBuffer, color, texture.width,
-		                    texture.height, iterations, zoom, pos, sampleCount);
-#else
-		cl_float2 posf = {(cl_float) pos.s[0], (cl_float) pos.s[1]};
-		(*renderKernelFunc)(eargs, imageBuffer, imageRawBuffer, randStatesBuffer, color, texture.width,
-							texture.height, iterations, (cl_float) zoom, posf, sampleCount);
-#endif
-		queue.enqueueReleaseGLObjects(&glObjs);
-		queue.finish();
+		if (needsTuning)
+			tune();
+		// the new formula replaces all kernels between two launches, the image starts again
+		refresh = swapFormula() || refresh;
+		launch(refresh);
+		if (workCounters)
+		{
+			std::cout << "[OCLRenderer] sample " << sampleCount << ": " << lastWork.iterations << " iterations in " <<
+			lastWork.seconds * 1000.0 << "ms (" << lastWork.iterations / lastWork.seconds * 1e-9 << " Giterations/s), " <<
+			lastWork.escaped << " escaped, " << lastWork.interior << " interior";
+			if (lastWork.escaped)
+				std::cout << ", escape iterations " << lastWork.minEscape << " - " << lastWork.maxEscape;
+			std::cout << std::endl;
+		}
 	}
 	catch (cl::Error error)
 	{
@@ -177,12 +912,65 @@ void OCLRenderer::reshape(size_t width, size_t height)
 	imageBuffer = cl::Image2DGL(context, CL_MEM_READ_WRITE, GL_TEXTURE_2D, 0, texture.id);
 #endif
 	imageRawBuffer = cl::Buffer(context, CL_MEM_READ_ONLY, width * height * sizeof(cl_float4));
+	// the host maps the resolved image, with unified memory it is allocated where the host can read it in place
+	resolvedBuffer = cl::Buffer(context, CL_MEM_WRITE_ONLY | (unifiedMemory ? CL_MEM_ALLOC_HOST_PTR : 0), width * height * sizeof(cl_uchar4));
 	randStatesBuffer = cl::Buffer(context, CL_MEM_READ_ONLY, width * height * sizeof(cl_uint4));
 	cl_uint *randStatesInitial = new cl_uint[4 * width * height];
 	for (size_t i = 0; i < 4 * width * height; ++i)
 		randStatesInitial[i] = i;
 	queue.enqueueWriteBuffer(randStatesBuffer, CL_TRUE, 0, width * height * sizeof(cl_uint4), randStatesInitial);
 	delete[] randStatesInitial;
+
+	// queue of the pixel blocks for the persistent kernel, in Hilbert order skipping the blocks outside the image
+	const size_t blocksX = (width + PERSISTENT_BLOCK - 1) / PERSISTENT_BLOCK;
+	const size_t blocksY = (height + PERSISTENT_BLOCK - 1) / PERSISTENT_BLOCK;
+	const size_t n = cl::nextPowOfTwo(std::max(blocksX, blocksY));
+	std::vector<cl_uint2> blockOrder;
+	blockOrder.reserve(blocksX * blocksY);
+	for (size_t d = 0; d < n * n; ++d)
+	{
+		size_t x, y;
+		hilbertToXY(n, d, x, y);
+		if (x < blocksX && y < blocksY)
+			blockOrder.push_back({(cl_uint) x, (cl_uint) y});
+	}
+	blockCount = blockOrder.size();
+	blockOrderBuffer = cl::Buffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, blockCount * sizeof(cl_uint2), &blockOrder[0]);
+	blockCounterBuffer = cl::Buffer(context, CL_MEM_READ_WRITE, sizeof(cl_uint));
+
+	// wavefront state, the compaction ping-pongs between the live buffers
+	liveBuffers[0] = cl::Buffer(context, CL_MEM_READ_WRITE, width * height * sizeof(LivePixel));
+	liveBuffers[1] = cl::Buffer(context, CL_MEM_READ_WRITE, width * height * sizeof(LivePixel));
+	aliveBuffer = cl::Buffer(context, CL_MEM_READ_WRITE, width * height * sizeof(cl_uint));
+	offsetsBuffer = cl::Buffer(context, CL_MEM_READ_WRITE, width * height * sizeof(cl_uint));
+	liveCountBuffer = cl::Buffer(context, CL_MEM_READ_WRITE, sizeof(cl_uint));
+	// orbit density mode, the boundary cells don't depend on the size
+	densityBuffer = cl::Buffer(context, CL_MEM_READ_WRITE, width * height * sizeof(cl_uint));
+	if (!densityCellsBuffer())
+	{
+		densityCellsBuffer = cl::Buffer(context, CL_MEM_READ_ONLY, DENSITY_CELLS * DENSITY_CELLS * sizeof(cl_uint));
+		densityStatsBuffer = cl::Buffer(context, CL_MEM_READ_WRITE, 4 * sizeof(cl_uint));
+	}
+	// per pixel state of chunked samples
+	pixelStateBuffer = cl::Buffer(context, CL_MEM_READ_WRITE, width * height * sizeof(LivePixel));
+	chunkedSampleRunning = false;
+	pixelStateValid = false;
+	if (previousRawBuffer())
+		previousRawBuffer = cl::Buffer(context, CL_MEM_READ_WRITE, width * height * sizeof(cl_float4));
+	comparedSample = 0;
+
+	// histogram coloring, the prefix sums of the histogram share the block sums with the wavefront mode
+	smoothIterationsBuffer = cl::Buffer(context, CL_MEM_READ_WRITE, width * height * sizeof(cl_float));
+	histogramRangeBuffer = cl::Buffer(context, CL_MEM_READ_WRITE, 2 * sizeof(cl_uint));
+	histogramBuffer = cl::Buffer(context, CL_MEM_READ_WRITE, HISTOGRAM_BINS * sizeof(cl_uint));
+	cdfBuffer = cl::Buffer(context, CL_MEM_READ_WRITE, HISTOGRAM_BINS * sizeof(cl_uint));
+
+	scanSumsBuffers.clear();
+	for (size_t n = std::max(width * height, HISTOGRAM_BINS); n > 1 || scanSumsBuffers.empty();)
+	{
+		n = (n + 2 * SCAN_BLOCK - 1) / (2 * SCAN_BLOCK);
+		scanSumsBuffers.push_back(cl::Buffer(context, CL_MEM_READ_WRITE, n * sizeof(cl_uint)));
+	}
 	glObjs.clear();
 	glObjs.push_back(imageBuffer);
 }
@@ -260,6 +1048,31 @@ const cl_float3 &OCLRenderer::getColor() const
 void OCLRenderer::setColor(const cl_float3 &color)
 {
 	OCLRenderer::color = color;
+	uploadPalette();
+}
+
+const Palette &OCLRenderer::getPalette() const
+{
+	return palette;
+}
+
+void OCLRenderer::setPalette(const Palette &palette)
+{
+	OCLRenderer::palette = palette;
+	uploadPalette();
+}
+
+void OCLRenderer::uploadPalette()
+{
+	try
+	{
+		palette.upload(queue, paletteImage, color);
+	}
+	catch (cl::Error error)
+	{
+		std::cout << error.what() << "(" << cl::errorString(error.err()) << ")" << std::endl;
+		exit(EXIT_FAILURE);
+	}
 }
 
 int OCLRenderer::getSampleCount() const
@@ -277,15 +1090,339 @@ void OCLRenderer::setIterations(cl_int iterations)
 	OCLRenderer::iterations = iterations;
 }
 
-std::shared_ptr<std::vector<cl_float>> OCLRenderer::getImage() const
+RenderMode OCLRenderer::getRenderMode() const
+{
+	return renderMode;
+}
+
+void OCLRenderer::setRenderMode(RenderMode renderMode)
+{
+	OCLRenderer::renderMode = renderMode;
+}
+
+ColorMode OCLRenderer::getColorMode() const
+{
+	return colorMode;
+}
+
+void OCLRenderer::setColorMode(ColorMode colorMode)
+{
+	OCLRenderer::colorMode = colorMode;
+	try
+	{
+		buildKernel(vectorWidth);
+	}
+	catch (cl::Error error)
+	{
+		std::cout << error.what() << "(" << cl::errorString(error.err()) << ")" << std::endl;
+
+		if (error.err() == CL_BUILD_PROGRAM_FAILURE)
+			std::cout << "Build log:" << std::endl << program.getBuildInfo<CL_PROGRAM_BUILD_LOG>(device) << std::endl;
+
+		exit(EXIT_FAILURE);
+	}
+}
+
+const cl_double2 &OCLRenderer::getJuliaC() const
+{
+	return juliaC;
+}
+
+void OCLRenderer::setJuliaC(double x, double y)
+{
+	juliaC = {x, y};
+	densityCellsIterations = -1;
+}
+
+const std::string &OCLRenderer::getFormula() const
+{
+	return formula;
+}
+
+bool OCLRenderer::setFormula(const std::string &formula)
+{
+	if (FORMULAS.find(formula) == FORMULAS.end())
+	{
+		std::cerr << "[OCLRenderer] unknown formula " << formula << std::endl;
+		return false;
+	}
+	if (formula == OCLRenderer::formula)
+	{
+		nextFormula.clear();
+		return true;
+	}
+	// the tuned configuration of the formula if there is one, the current one otherwise
+	nextConfiguration = {vectorWidth, localSizeX, localSizeY};
+	TuningCache(TUNING_CACHE_FILE).lookup(tuningKey(formula), nextConfiguration);
+	nextFormula = formula;
+	kernelCompiler->request(kernelOptions(formula, nextConfiguration.vectorWidth), true);
+	return true;
+}
+
+bool OCLRenderer::exportIterationField(const std::string &filename, bool half)
+{
+	if (!stateMatchesView() || stateProgress != iterations)
+	{
+		std::cerr << "[OCLRenderer] the current view isn't completely rendered, nothing to export" << std::endl;
+		return false;
+	}
+	std::ofstream file(filename, std::ios::binary);
+	IterationField::Header header = IterationField::makeHeader(texture.width, texture.height, half);
+	header.iterations = iterations;
+	header.zoom = zoom;
+	const cl_double2 position = samplePos();
+	header.posX = position.s[0];
+	header.posY = position.s[1];
+	formula.copy(header.formula, sizeof(header.formula) - 1);
+	std::vector<char> padding(header.payloadOffset - sizeof(header), 0);
+	file.write((const char *) &header, sizeof(header));
+	file.write(padding.data(), padding.size());
+
+	// one row of tiles per launch, the next band is computed while the last one is written
+	const size_t tilesX = IterationField::tilesX(header);
+	const size_t bandBytes = tilesX * IterationField::tileBytes(header);
+	cl::Buffer bands[2];
+	const char *hostBands[2] = {nullptr, nullptr};
+	try
+	{
+		// the bands are mapped for writing them to the file, with unified memory that doesn't copy them
+		const cl_mem_flags flags = CL_MEM_WRITE_ONLY | (unifiedMemory ? CL_MEM_ALLOC_HOST_PTR : 0);
+		bands[0] = cl::Buffer(context, flags, bandBytes);
+		bands[1] = cl::Buffer(context, flags, bandBytes);
+		cl::Event read[2];
+		const size_t bandCount = IterationField::tilesY(header);
+		for (size_t band = 0; band <= bandCount; ++band)
+		{
+			if (band < bandCount)
+			{
+				cl::EnqueueArgs eargs(queue, cl::NDRange(tilesX * header.tileSize, header.tileSize));
+				if (half)
+					(*exportFieldHalfFunc)(eargs, pixelStateBuffer, bands[band % 2], texture.width, texture.height, iterations, header.tileSize,
+					                       band * header.tileSize);
+				else
+					(*exportFieldFunc)(eargs, pixelStateBuffer, bands[band % 2], texture.width, texture.height, iterations, header.tileSize,
+					                   band * header.tileSize);
+				hostBands[band % 2] = (const char *) queue.enqueueMapBuffer(bands[band % 2], CL_FALSE, CL_MAP_READ, 0, bandBytes, nullptr,
+				                                                            &read[band % 2]);
+			}
+			if (band > 0)
+			{
+				read[(band - 1) % 2].wait();
+				file.write(hostBands[(band - 1) % 2], bandBytes);
+				queue.enqueueUnmapMemObject(bands[(band - 1) % 2], (void *) hostBands[(band - 1) % 2]);
+				hostBands[(band - 1) % 2] = nullptr;
+			}
+		}
+	}
+	catch (cl::Error error)
+	{
+		std::cerr << "[OCLRenderer] export failed: " << error.what() << "(" << cl::errorString(error.err()) << ")" << std::endl;
+		// the bands must not be released while they are mapped
+		try
+		{
+			for (int i = 0; i < 2; ++i)
+				if (hostBands[i])
+					queue.enqueueUnmapMemObject(bands[i], (void *) hostBands[i]);
+			queue.finish();
+		}
+		catch (cl::Error)
+		{ }
+		return false;
+	}
+	if (!file)
+	{
+		std::cerr << "[OCLRenderer] couldn't write " << filename << std::endl;
+		return false;
+	}
+	std::cout << "[OCLRenderer] exported the iteration field to " << filename << std::endl;
+	return true;
+}
+
+void OCLRenderer::setTileCache(size_t memoryBudget, const std::string &spillDirectory, size_t diskBudget)
+{
+	tileCache.reset(memoryBudget ? new TileCache(memoryBudget, spillDirectory, diskBudget) : nullptr);
+}
+
+bool OCLRenderer::isTileCaching() const
+{
+	return (bool) tileCache;
+}
+
+void OCLRenderer::setWorkCounters(bool workCounters)
+{
+	OCLRenderer::workCounters = workCounters;
+	try
+	{
+		if (workCounters && !countersBuffer())
+			countersBuffer = cl::Buffer(context, CL_MEM_READ_WRITE, WORK_COUNTERS * sizeof(cl_uint));
+		buildKernel(vectorWidth);
+	}
+	catch (cl::Error error)
+	{
+		std::cout << error.what() << "(" << cl::errorString(error.err()) << ")" << std::endl;
+
+		if (error.err() == CL_BUILD_PROGRAM_FAILURE)
+			std::cout << "Build log:" << std::endl << program.getBuildInfo<CL_PROGRAM_BUILD_LOG>(device) << std::endl;
+
+		exit(EXIT_FAILURE);
+	}
+}
+
+void OCLRenderer::setImportanceSampling(bool importanceSampling)
+{
+	OCLRenderer::importanceSampling = importanceSampling;
+}
+
+bool OCLRenderer::isImportanceSampling() const
+{
+	return importanceSampling;
+}
+
+bool OCLRenderer::isCountingWork() const
+{
+	return workCounters;
+}
+
+const WorkCounters &OCLRenderer::getWorkCounters() const
+{
+	return lastWork;
+}
+
+void OCLRenderer::setConvergenceTarget(cl_int sampleTarget, double noiseThreshold)
+{
+	OCLRenderer::sampleTarget = sampleTarget;
+	OCLRenderer::noiseThreshold = noiseThreshold;
+	try
+	{
+		if (noiseThreshold > 0.0 && !previousRawBuffer())
+		{
+			previousRawBuffer = cl::Buffer(context, CL_MEM_READ_WRITE, texture.width * texture.height * sizeof(cl_float4));
+			changedBuffer = cl::Buffer(context, CL_MEM_READ_WRITE, sizeof(cl_uint));
+		}
+	}
+	catch (cl::Error error)
+	{
+		std::cout << error.what() << "(" << cl::errorString(error.err()) << ")" << std::endl;
+		exit(EXIT_FAILURE);
+	}
+}
+
+cl_int OCLRenderer::getSampleTarget() const
+{
+	return sampleTarget;
+}
+
+double OCLRenderer::getNoiseThreshold() const
+{
+	return noiseThreshold;
+}
+
+double OCLRenderer::getNoise() const
+{
+	return noise;
+}
+
+bool OCLRenderer::isConverged() const
+{
+	// a selected formula and the tuning are only picked up by render
+	if (chunkedSampleRunning || needsTuning || !nextFormula.empty())
+		return false;
+	return (sampleTarget > 0 && sampleCount >= sampleTarget) || (noiseThreshold > 0.0 && noise <= noiseThreshold);
+}
+
+void OCLRenderer::setMirroring(bool mirroring)
+{
+	OCLRenderer::mirroring = mirroring;
+}
+
+bool OCLRenderer::isMirroring() const
+{
+	return mirroring;
+}
+
+bool OCLRenderer::isSymmetric() const
+{
+	if (formula == "julia_set")
+		return juliaC.s[1] == 0.0;
+	return formula == "mandelbrot" || formula == "mandelbrot_cubic" || formula == "tricorn";
+}
+
+cl_double2 OCLRenderer::samplePos() const
 {
-	std::shared_ptr<std::vector<cl_float>> retVal(new std::vector<cl_float>(texture.width * texture.height * 4));
+	// the axis at a row boundary or center, so the mirrored rows sample exactly the conjugate points
+	const double axisRows = std::round(-2.0 * pos.s[1] * texture.width);
+	if (!mirroring || !isSymmetric() || axisRows < 0.0 || axisRows > 2.0 * texture.height)
+		return pos;
+	return {pos.s[0], -axisRows / (2.0 * texture.width)};
+}
+
+std::shared_ptr<const cl_uchar> OCLRenderer::getImage(ToneCurve toneCurve)
+{
+	const cl_uint n = texture.width * texture.height;
 	glFinish();
-	queue.enqueueReadBuffer(imageRawBuffer, CL_TRUE, 0, texture.width * texture.height * sizeof(cl_float4),
-	                        &((*retVal)[0]));
-	queue.finish();
-	for (size_t i = 0; i < texture.width * texture.height * 4; ++i)
-		(*retVal)[i] /= sampleCount;
-	return retVal;
+	(*resolveFunc)(cl::EnqueueArgs(queue, cl::NDRange(cl::nextDivisible(n, RESOLVE_LOCAL)), cl::NDRange(RESOLVE_LOCAL)), imageRawBuffer,
+	               resolvedBuffer, sampleCount, n, (cl_int) toneCurve);
+	// with unified memory the mapping is the buffer itself, otherwise the driver copies it into host memory
+	const cl_uchar *pixels = (const cl_uchar *) queue.enqueueMapBuffer(resolvedBuffer, CL_TRUE, CL_MAP_READ, 0, n * sizeof(cl_uchar4));
+	const cl::CommandQueue mapQueue = queue;
+	const cl::Buffer mapped = resolvedBuffer;
+	return std::shared_ptr<const cl_uchar>(pixels, [mapQueue, mapped](const cl_uchar *p)
+	{
+		try
+		{
+			mapQueue.enqueueUnmapMemObject(mapped, (void *) p);
+		}
+		catch (cl::Error error)
+		{
+			std::cerr << "[OCLRenderer] unmapping the image failed: " << error.what() << "(" << cl::errorString(error.err()) << ")" << std::endl;
+		}
+	});
+}
+
+std::shared_ptr<const cl_uchar> OCLRenderer::renderViewports(const std::string &formula, const std::vector<Viewport> &viewports,
+                                                             size_t size)
+{
+	if (FORMULAS.find(formula) == FORMULAS.end() || viewports.empty() || !size)
+		return nullptr;
+	// the variant without vectors and extras but the palette, usually built in the background already
+	bool built;
+	cl::Program variant = kernelCompiler->get(templateOptions(formula, bailoutUnroll), built);
+	if (!built)
+	{
+		std::cerr << "[OCLRenderer] couldn't build formula " << formula << ":" << std::endl << variant.getBuildInfo<CL_PROGRAM_BUILD_LOG>(device) << std::endl;
+		return nullptr;
+	}
+	const cl_uint texels = viewports.size() * size * size;
+	try
+	{
+		cl::Buffer viewportsBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, viewports.size() * sizeof(Viewport), (void *) viewports.data());
+		cl::Buffer atlas(context, CL_MEM_READ_WRITE, texels * sizeof(cl_float));
+		cl::Buffer rgba(context, CL_MEM_WRITE_ONLY | (unifiedMemory ? CL_MEM_ALLOC_HOST_PTR : 0), texels * sizeof(cl_uchar4));
+		cl::make_kernel<cl::Buffer &, cl::Buffer &, cl_int> viewportsRender(cl::Kernel(variant, "viewports_render"));
+		cl::Kernel colorizeKernel(variant, "tile_colorize");
+		colorizeKernel.setArg(4, paletteImage);
+		cl::make_kernel<cl::Buffer &, cl::Buffer &, cl_float3, cl_uint> colorize(colorizeKernel);
+		// all viewports in one launch, so many small ones still fill the device
+		viewportsRender(cl::EnqueueArgs(queue, cl::NDRange(size, size, viewports.size())), atlas, viewportsBuffer, (cl_int) size);
+		colorize(cl::EnqueueArgs(queue, cl::NDRange(cl::nextDivisible(texels, 256)), cl::NDRange(256)), atlas, rgba, color, texels);
+		const cl_uchar *pixels = (const cl_uchar *) queue.enqueueMapBuffer(rgba, CL_TRUE, CL_MAP_READ, 0, texels * sizeof(cl_uchar4));
+		const cl::CommandQueue mapQueue = queue;
+		return std::shared_ptr<const cl_uchar>(pixels, [mapQueue, rgba](const cl_uchar *p)
+		{
+			try
+			{
+				mapQueue.enqueueUnmapMemObject(rgba, (void *) p);
+			}
+			catch (cl::Error error)
+			{
+				std::cerr << "[OCLRenderer] unmapping the viewports failed: " << error.what() << "(" << cl::errorString(error.err()) << ")" << std::endl;
+			}
+		});
+	}
+	catch (cl::Error error)
+	{
+		std::cerr << "[OCLRenderer] rendering the viewports failed: " << error.what() << "(" << cl::errorString(error.err()) << ")" << std::endl;
+		return nullptr;
+	}
 }
 
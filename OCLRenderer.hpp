@@ -4,7 +4,90 @@
 
 #include <CL/cl.hpp>
 #include <memory>
+#include <chrono>
 #include "Texture.hpp"
+#include "TileCache.hpp"
+#include "TuningCache.hpp"
+#include "KernelCompiler.hpp"
+#include "Palette.hpp"
+
+// host side types matching the precision the kernels are built with
+#ifdef USE_DOUBLE
+typedef cl_double cl_real;
+typedef cl_double2 cl_real2;
+#else
+typedef cl_float cl_real;
+typedef cl_float2 cl_real2;
+#endif
+
+/**
+ * how the work is distributed over the device
+ */
+enum RenderMode
+{
+	// one work-item per pixel (or strip of pixels with the vectorized kernel)
+	DIRECT,
+	// a few persistent work-groups fetch pixel blocks in Hilbert order from an atomic counter
+	PERSISTENT,
+	// all pixels are iterated in chunks, after each chunk the still bounded pixels are compacted
+	WAVEFRONT,
+	// orbit density (Buddhabrot): the escaping orbits of random c are traced and every point is counted in its pixel
+	DENSITY
+};
+
+/**
+ * how the escaped pixels are colored
+ */
+enum ColorMode
+{
+	// smooth iteration count through the cosine palette
+	SMOOTH,
+	// histogram equalized smooth iteration count, the palette is spread evenly over the escaped pixels
+	HISTOGRAM
+};
+
+/**
+ * tone curve of the exported 8 bit images, the values match TONE_* in the kernel
+ */
+enum ToneCurve
+{
+	// the accumulated colors clamped to [0, 1]
+	LINEAR,
+	// display gamma of 2.2
+	GAMMA,
+	// filmic shoulder (ACES fit) and display gamma, compresses bright colors instead of clipping them
+	FILMIC
+};
+
+/**
+ * work of the last render call, counted by the kernels
+ */
+struct WorkCounters
+{
+	// iterations of all pixels
+	cl_ulong iterations;
+	// finished pixels that escaped
+	cl_uint escaped;
+	// finished pixels that reached the iteration limit
+	cl_uint interior;
+	// range of the escape iterations, min > max if nothing escaped
+	cl_uint minEscape;
+	cl_uint maxEscape;
+	// from the first launch to the end of the last one
+	double seconds;
+};
+
+/**
+ * a square view of a batch rendered by renderViewports, same layout as Viewport in the kernel. The pixel (x, y) is
+ * at origin + ((x, y) + 0.5) * extent / size, juliaC is only used by the julia formula
+ */
+struct Viewport
+{
+	cl_real2 origin;
+	cl_real2 juliaC;
+	cl_real extent;
+	cl_int iterations;
+};
 
 class OCLRenderer
 {
@@ -15,18 +98,140 @@ private:
 	cl_float3 color;
 	cl_int sampleCount;
 	cl_int iterations;
+	// constant c of the julia set
+	cl_double2 juliaC;
+	// the bailout is checked only every bailoutUnroll iterations
+	cl_uint bailoutUnroll;
+	// number of horizontally adjacent pixels computed by one work-item
+	cl_uint vectorWidth;
+	// work-group size, found by the autotuner
+	size_t localSizeX;
+	size_t localSizeY;
+	bool needsTuning;
+	RenderMode renderMode;
+	ColorMode colorMode;
+	// maximum iterations per launch, adapted to the speed of the device
+	cl_int iterationChunk;
+	// iteration all still bounded pixels of the stored pixel state have reached
+	cl_int stateProgress;
+	// iteration the running chunked sample has reached
+	cl_int sampleProgress;
+	bool chunkedSampleRunning;
+	// view of the stored pixel state, it can only be continued while the view doesn't change
+	bool pixelStateValid;
+	cl_double stateZoom;
+	cl_double2 statePos;
+	cl_double2 stateJuliaC;
+	// cached tiles the views are composed of, disabled if null
+	std::shared_ptr<TileCache> tileCache;
+	// number of tiles that fit into the atlas buffer
+	size_t atlasCapacity;
+	// compute only one half of views crossing the real axis and mirror it, if the formula is symmetric
+	bool mirroring;
+	// the render kernels are built with WORK_COUNTERS and the counters are printed after every render call
+	bool workCounters;
+	WorkCounters lastWork;
+	// the image is done after sampleTarget samples or once at most noiseThreshold of the pixels changed visibly
+	// with the last sample, 0 disables either
+	cl_int sampleTarget;
+	double noiseThreshold;
+	// fraction of the pixels that changed visibly with the last sample, 1 before the second sample
+	double noise;
+	// sample whose accumulated colors are kept for the comparison with the next one, 0 if there is none
+	cl_int comparedSample;
+	// draw the c of the orbit density mode only from the cells near the boundary of the set
+	bool importanceSampling;
+	// iterations the boundary cells were found for, -1 if they have to be found again
+	cl_int densityCellsIterations;
+	cl_uint densityCellCount;
+	// orbits traced since the last report of the orbit density mode
+	std::chrono::steady_clock::time_point densityReportStart;
+	cl_ulong densityTested;
+	cl_ulong densityOrbits;
+	cl_ulong densityPoints;
+	// number of work-groups launched in the persistent mode
+	size_t persistentGroups;
+	// work-items of a persistent work-group, at most one per pixel of a block
+	size_t persistentLocal;
+	cl_uint blockCount;
 
 	cl::Context context;
 	cl::Device device;
+	// the device shares the memory of the host, buffers the host reads are allocated there and mapped in place
+	bool unifiedMemory;
+	// builds the variants of the kernel template, in the background for the formulas that aren't used yet
+	std::shared_ptr<KernelCompiler> kernelCompiler;
+	// formula that replaces the current one once it is built, empty if there is none
+	std::string nextFormula;
+	TuningCache::Entry nextConfiguration;
 	cl::Program program;
+	std::string programSource;
+	std::string sourceFilename;
+	std::string formula;
+	cl::Kernel renderKernel;
 	cl::CommandQueue queue;
 	cl::Buffer randStatesBuffer;
 	cl::Buffer imageRawBuffer;
-#ifdef USE_DOUBLE
-	std::shared_ptr<cl::make_kernel<cl::ImageGL &, cl::Buffer &, cl::Buffer &, cl_float3, cl_int, cl_int, cl_int, cl_double, cl_double2, cl_int>> renderKernelFunc;
-#else
-	std::shared_ptr<cl::make_kernel<cl::ImageGL &, cl::Buffer&, cl::Buffer&, cl_float3, cl_int, cl_int, cl_int, cl_float, cl_float2, cl_int>> renderKernelFunc;
-#endif
+	cl::Buffer blockCounterBuffer;
+	cl::Buffer blockOrderBuffer;
+	// smooth iteration count of the current sample, -1 inside the set, only written with histogram coloring
+	cl::Buffer smoothIterationsBuffer;
+	// lowest and highest escaped smooth iteration count of the sample as float bits, the bins span this range
+	cl::Buffer histogramRangeBuffer;
+	cl::Buffer histogramBuffer;
+	cl::Buffer cdfBuffer;
+	// orbit density mode: points per pixel, the indices of the boundary cells and the counts of a launch
+	cl::Buffer densityBuffer;
+	cl::Buffer densityCellsBuffer;
+	cl::Buffer densityStatsBuffer;
+	// counters of the kernels, see WORK_COUNTERS in the kernel
+	cl::Buffer countersBuffer;
+	// RGBA8 image resolved from the accumulated samples
+	cl::Buffer resolvedBuffer;
+	// the escaped pixels are colored through this palette, baked with the color into a table of Palette::SIZE texels
+	Palette palette;
+	cl::Image1D paletteImage;
+	// accumulated colors of the previous sample and the number of pixels that changed visibly since, only allocated
+	// with a noise threshold
+	cl::Buffer previousRawBuffer;
+	cl::Buffer changedBuffer;
+	// grid of the visible tiles and the tile jobs (x, y, level, atlas slot) of the ones rendered in this frame
+	cl::Buffer atlasBuffer;
+	cl::Buffer tileJobsBuffer;
+	// per pixel z, c and iteration count of the first sample, kept for raised iteration limits and the export
+	cl::Buffer pixelStateBuffer;
+	// ping-pong buffers with the state of the still bounded pixels in the wavefront mode, the first one also holds
+	// the pixel state of the later chunked samples, which never run in the wavefront mode
+	cl::Buffer liveBuffers[2];
+	cl::Buffer aliveBuffer;
+	cl::Buffer offsetsBuffer;
+	cl::Buffer liveCountBuffer;
+	// block sums of every level of the prefix sum
+	std::vector<cl::Buffer> scanSumsBuffers;
+	std::shared_ptr<cl::make_kernel<cl::ImageGL &, cl::Buffer &, cl::Buffer &, cl::Buffer &, cl::Buffer &, cl_float3, cl_int, cl_int, cl_int, cl_real, cl_real2, cl_int, cl_real2>> renderKernelFunc;
+	std::shared_ptr<cl::make_kernel<cl::ImageGL &, cl::Buffer &, cl::Buffer &, cl::Buffer &, cl::Buffer &, cl_float3, cl_int, cl_int, cl_int, cl_real, cl_real2, cl_int, cl_real2,
+			cl_int, cl_int, cl_int>> mirroredKernelFunc;
+	std::shared_ptr<cl::make_kernel<cl::ImageGL &, cl::Buffer &, cl::Buffer &, cl::Buffer &, cl::Buffer &, cl_float3, cl_int, cl_int, cl_int, cl_real, cl_real2, cl_int, cl_real2,
+			cl::Buffer &, cl::Buffer &, cl_uint>> persistentKernelFunc;
+	std::shared_ptr<cl::make_kernel<cl::Buffer &, cl::Buffer &, cl_int, cl_int, cl_real, cl_real2, cl_real2>> wavefrontStartFunc;
+	std::shared_ptr<cl::make_kernel<cl::ImageGL &, cl::Buffer &, cl::Buffer &, cl::Buffer &, cl::Buffer &, cl::Buffer &, cl_float3, cl_int, cl_uint, cl_int, cl_int, cl_int>> wavefrontIterateFunc;
+	std::shared_ptr<cl::make_kernel<cl::Buffer &, cl::Buffer &, cl::Buffer &, cl::Buffer &, cl::Buffer &, cl_uint>> wavefrontCompactFunc;
+	std::shared_ptr<cl::make_kernel<cl::ImageGL &, cl::Buffer &, cl::Buffer &, cl::Buffer &, cl_float3, cl_int, cl_int, cl_int, cl_int, cl_int, cl_int, cl_int>> chunkIterateFunc;
+	std::shared_ptr<cl::make_kernel<cl::Buffer &, cl::Buffer &, cl_real2, cl_real, cl_int, cl_real2>> tileRenderFunc;
+	std::shared_ptr<cl::make_kernel<cl::ImageGL &, cl::Buffer &, cl::Buffer &, cl::Buffer &, cl_float3, cl_int, cl_int, cl_real, cl_real2, cl_real2, cl_real, cl_int, cl_int>> tileComposeFunc;
+	std::shared_ptr<cl::make_kernel<cl::Buffer &, cl::Buffer &, cl_int, cl_int, cl_int, cl_int, cl_int>> exportFieldFunc;
+	std::shared_ptr<cl::make_kernel<cl::Buffer &, cl::Buffer &, cl_int, cl_int, cl_int, cl_int, cl_int>> exportFieldHalfFunc;
+	std::shared_ptr<cl::make_kernel<cl::Buffer &, cl::Buffer &, cl_int, cl_uint, cl_int>> resolveFunc;
+	std::shared_ptr<cl::make_kernel<cl::Buffer &, cl::Buffer &, cl::Buffer &, cl_int, cl_uint>> sampleChangeFunc;
+	std::shared_ptr<cl::make_kernel<cl::Buffer &, cl::Buffer &, cl_uint>> histogramRangeFunc;
+	std::shared_ptr<cl::make_kernel<cl::Buffer &, cl::Buffer &, cl_uint, cl::Buffer &>> histogramBuildFunc;
+	std::shared_ptr<cl::make_kernel<cl::ImageGL &, cl::Buffer &, cl::Buffer &, cl::Buffer &, cl::Buffer &, cl_float3, cl_int, cl_int, cl::Buffer &, cl_int>> histogramColorFunc;
+	std::shared_ptr<cl::make_kernel<cl::Buffer &, cl_int, cl_real2>> densityCellsFunc;
+	std::shared_ptr<cl::make_kernel<cl::Buffer &, cl::Buffer &, cl::Buffer &, cl_uint, cl::Buffer &, cl_int, cl_int, cl_int, cl_real, cl_real2, cl_int, cl_real2>> densitySplatFunc;
+	std::shared_ptr<cl::make_kernel<cl::Buffer &, cl::Buffer &, cl_uint>> densityMaxFunc;
+	std::shared_ptr<cl::make_kernel<cl::ImageGL &, cl::Buffer &, cl::Buffer &, cl::Buffer &, cl_float3, cl_int, cl_int, cl_int>> densityColorFunc;
+	std::shared_ptr<cl::make_kernel<cl::Buffer &, cl::Buffer &, cl::Buffer &, cl_uint>> scanBlocksFunc;
+	std::shared_ptr<cl::make_kernel<cl::Buffer &, cl::Buffer &, cl_uint>> scanAddFunc;
 	std::vector<cl::Memory> glObjs;
 #ifdef CL_VERSION_1_2
 	cl::ImageGL imageBuffer;
@@ -35,6 +240,102 @@ private:
 #endif
 	Texture texture;
 
+	/**
+	 * @return the build options specializing the kernel template for the formula, the precision, bailout policy,
+	 * coloring, palette table and work counters and the given vector width
+	 */
+	std::string kernelOptions(const std::string &formula, cl_uint width) const;
+
+	/**
+	 * specializes the kernel template for the current formula, precision, bailout policy and
+	 * the given vector width and creates the render kernel
+	 *
+	 * @return the vector width actually used, 1 if the program has no vectorized kernel
+	 */
+	cl_uint buildKernel(cl_uint width);
+
+	/**
+	 * bakes the palette with the current color and writes it to the palette image
+	 */
+	void uploadPalette();
+
+	/**
+	 * queues all formulas with the current options for the background compiler
+	 */
+	void precompileFormulas();
+
+	/**
+	 * replaces the kernels by the ones of the selected formula if its build finished, a failed build keeps the
+	 * current formula
+	 *
+	 * @return true if the formula changed
+	 */
+	bool swapFormula();
+
+	/**
+	 * the preferred vector width of the device rounded to a valid OpenCL vector size
+	 */
+	cl_uint preferredVectorWidth() const;
+
+	/**
+	 * identifies device, driver and kernel of the formula in the tuning cache
+	 */
+	std::string tuningKey(const std::string &formula) const;
+
+	/**
+	 * benchmarks all sensible work-group sizes and vector widths at a representative view
+	 * and stores the fastest configuration in the tuning cache
+	 */
+	void tune();
+
+	/**
+	 * enqueues an exclusive prefix sum of the first n elements of in to out, in and out may be the same buffer
+	 *
+	 * @param level the recursion level, selects the buffer for the block sums
+	 */
+	void scan(cl::Buffer &in, cl::Buffer &out, cl_uint n, size_t level = 0);
+
+	/**
+	 * @return true if the fractal is symmetric about the real axis: the formulas that commute with complex
+	 * conjugation and the Julia sets of a real c
+	 */
+	bool isSymmetric() const;
+
+	/**
+	 * @return the position the samples are rendered at, with mirroring the views of a symmetric fractal that cross the
+	 * real axis are snapped to it by at most a quarter pixel on every render path, so all samples of a view line up
+	 */
+	cl_double2 samplePos() const;
+
+	/**
+	 * marks the cells of the orbit density grid near the boundary of the set and uploads their indices, the marked
+	 * cells are dilated by one, since the exterior next to the boundary has the longest escaping orbits
+	 */
+	void findDensityCells();
+
+	/**
+	 * enqueues one launch of the orbit density mode, the points are added to the density of the earlier samples
+	 */
+	void renderDensity(bool refresh);
+
+	/**
+	 * @return true if the stored pixel state belongs to the current view
+	 */
+	bool stateMatchesView() const;
+
+	/**
+	 * enqueues the composition of the view from the tiles of the finest level that is at least as fine as the view,
+	 * cached tiles are uploaded, missing ones are rendered in one launch and added to the cache
+	 */
+	void composeTiles();
+
+	/**
+	 * enqueues the render kernel and waits for it, errors are thrown
+	 *
+	 * @param allowResume if set a refresh with an unchanged view and a raised iteration limit continues the stored pixel state
+	 */
+	void launch(bool refresh, bool allowResume = true);
+
 public:
 	/**
 	 * initializes opencl with the gpuNumth device that has a gl context
@@ -42,16 +343,30 @@ public:
 	 * @param width the width of the desired texture size
 	 * @param height the height of the desired texture size
 	 * @param gpuNum the gpu with a gl context that will be chosen should be 0 in almost every case
-	 * @param kernelname the name of the kernel e.g. mandelbrot, julia_set or mandelbrot_alt
-	 * @param sourceFilename the filename of the opencl file
+	 * @param formula the fractal formula: mandelbrot, mandelbrot_cubic, burning_ship, tricorn or julia_set
+	 * @param sourceFilename the filename of the opencl kernel template
+	 * @param bailoutUnroll check the bailout only every bailoutUnroll iterations, 1 checks every iteration
+	 */
+	OCLRenderer(size_t width, size_t height, size_t gpuNum = 0, const std::string &formula = "mandelbrot",
+	            const std::string &sourceFilename = "kernels/default.cl", cl_uint bailoutUnroll = 1);
+
+	/**
+	 * opens the kernel template with the given filename and compiles it for the given formula and bailout policy,
+	 * if the device prefers vectors the vectorized kernel is used.
+	 * The launch configuration is read from the tuning cache, on a cache miss the first render tunes it
 	 */
-	OCLRenderer(size_t width, size_t height, size_t gpuNum = 0, const std::string &kernelname = "mandelbrot",
-	            const std::string &sourceFilename = "kernels/default.cl");
+	bool openProgram(const std::string &filename, const std::string &formula, cl_uint bailoutUnroll = 1);
 
 	/**
-	 * opens and compiles a program with the given filename and the given kernel name
+	 * @return the definitions specializing the kernel template for the formula and bailout policy, the kernels that
+	 * color read the palette table (see Palette), empty if there is no such formula
 	 */
-	bool openProgram(const std::string &filename, const std::string &kernelname);
+	static std::string templateOptions(const std::string &formula, cl_uint bailoutUnroll = 1);
+
+	/**
+	 * @return the names of all formulas
+	 */
+	static std::vector<std::string> formulaNames();
 
 	/**
 	 * prints all OpenCL devices
@@ -61,6 +376,9 @@ public:
 	/**
 	 * renders to the texture
 	 *
+	 * If the iterations don't fit into one short launch, a sample is split into several launches (chunks) and every
+	 * call advances it by one chunk, the pixels that are finished show up right away
+	 *
 	 * @param refresh if set to true the texture gets flushed and starts with 1 samples, otherwise there will be generated continously new samples for AA
 	 */
 	void render(bool refresh);
@@ -85,13 +403,144 @@ public:
 
 	const cl_float3 &getColor() const;
 
+	/**
+	 * sets the phases of the cosine palette or the rotation of a gradient, the palette table is baked again
+	 */
 	void setColor(const cl_float3 &color);
 
+	const Palette &getPalette() const;
+
+	/**
+	 * replaces the palette the escaped pixels are colored through
+	 */
+	void setPalette(const Palette &palette);
+
 	int getSampleCount() const;
 
 	cl_int getIterations() const;
 
 	void setIterations(cl_int iterations);
 
-	std::shared_ptr<std::vector<cl_float>> getImage() const ;
+	RenderMode getRenderMode() const;
+
+	void setRenderMode(RenderMode renderMode);
+
+	ColorMode getColorMode() const;
+
+	/**
+	 * switches the coloring, the kernels are rebuilt
+	 */
+	void setColorMode(ColorMode colorMode);
+
+	const cl_double2 &getJuliaC() const;
+
+	void setJuliaC(double x, double y);
+
+	/**
+	 * @return the formula that is rendered, a selected one only replaces it once it is built
+	 */
+	const std::string &getFormula() const;
+
+	/**
+	 * selects another formula. It is built in the background, if that didn't happen already, while the current
+	 * formula keeps rendering, and replaces it at the first render after the build
+	 *
+	 * @return false if there is no such formula
+	 */
+	bool setFormula(const std::string &formula);
+
+	/**
+	 * writes the smooth iteration count and the final |z| of every pixel of the first sample to a raw iteration field
+	 * file (see IterationField), streamed from the device one row of tiles at a time. The current view has to be
+	 * completely rendered. float16 halves the size, but iteration counts above 65504 don't fit
+	 *
+	 * @return false if there was nothing to export or the file couldn't be written
+	 */
+	bool exportIterationField(const std::string &filename, bool half = false);
+
+	/**
+	 * enables the tile cache, the first sample of every view is composed from cached tiles and only the missing tiles are
+	 * rendered, the following samples refine the view as usual
+	 *
+	 * @param memoryBudget bytes of tiles kept in memory, 0 disables the cache
+	 * @param spillDirectory existing directory for tiles evicted from memory, empty to drop them
+	 * @param diskBudget bytes of tiles kept in the spill directory
+	 */
+	void setTileCache(size_t memoryBudget, const std::string &spillDirectory = "", size_t diskBudget = 0);
+
+	bool isTileCaching() const;
+
+	/**
+	 * enables mirroring, views of a symmetric fractal that cross the real axis compute only the larger half in the
+	 * direct render mode and mirror it into the other half. The view is snapped to the axis by up to a quarter pixel
+	 */
+	void setMirroring(bool mirroring);
+
+	bool isMirroring() const;
+
+	/**
+	 * enables importance sampling in the orbit density mode, the c are drawn only from the cells of a coarse grid
+	 * that contain the boundary of the set and their neighbours. The cells farther away only have short orbits and
+	 * are skipped
+	 */
+	void setImportanceSampling(bool importanceSampling);
+
+	bool isImportanceSampling() const;
+
+	/**
+	 * enables the work counters, the kernels are rebuilt to count the iterations, the escaped and interior pixels and
+	 * the range of the escape iterations, which costs a little speed. Every render call prints them with the
+	 * iterations per second
+	 */
+	void setWorkCounters(bool workCounters);
+
+	bool isCountingWork() const;
+
+	/**
+	 * @return the work of the last render call, only counted while the work counters are enabled
+	 */
+	const WorkCounters &getWorkCounters() const;
+
+	/**
+	 * sets when the image is done, see isConverged. Counting the changed pixels for the noise threshold costs a
+	 * pass over the accumulated colors after every sample
+	 *
+	 * @param sampleTarget samples per pixel, 0 for no limit
+	 * @param noiseThreshold fraction of the pixels that may still change by more than half an 8 bit step with a
+	 * sample, 0 disables the test
+	 */
+	void setConvergenceTarget(cl_int sampleTarget, double noiseThreshold);
+
+	cl_int getSampleTarget() const;
+
+	double getNoiseThreshold() const;
+
+	/**
+	 * @return the fraction of the pixels that changed visibly with the last sample, 1 if it wasn't measured
+	 */
+	double getNoise() const;
+
+	/**
+	 * @return true if the image reached the convergence target and no selected formula or tuning is waiting for
+	 * the next render, further samples wouldn't change it visibly
+	 */
+	bool isConverged() const;
+
+	/**
+	 * resolves the accumulated samples on the device and maps the image, on devices with unified memory without
+	 * copying it
+	 *
+	 * @return width * height RGBA8 pixels, row by row. The image is unmapped when the pointer is released, which
+	 * has to happen before the next render
+	 */
+	std::shared_ptr<const cl_uchar> getImage(ToneCurve toneCurve = LINEAR);
+
+	/**
+	 * renders all viewports in one launch with the formula, which doesn't have to be the current one, and colors
+	 * them with the current color and palette
+	 *
+	 * @return the RGBA8 pixels of the viewports one after another, each size * size row by row. They are unmapped
+	 * when the pointer is released
+	 */
+	std::shared_ptr<const cl_uchar> renderViewports(const std::string &formula, const std::vector<Viewport> &viewports, size_t size);
 };
@@ -0,0 +1,132 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <cmath>
+#include <dirent.h>
+#include "Palette.hpp"
+
+constexpr float Palette::PERIOD;
+
+Palette::Palette() : name("cosine")
+{ }
+
+bool Palette::load(const std::string &filename)
+{
+	std::ifstream file(filename);
+	if (!file)
+		return false;
+	std::vector<std::pair<float, cl_float3>> loaded;
+	std::string line;
+	while (std::getline(file, line))
+	{
+		if (line.empty() || line[0] == '#')
+			continue;
+		float position, red, green, blue;
+		std::istringstream values(line);
+		if (!(values >> position >> red >> green >> blue))
+		{
+			std::cerr << "[Palette] " << filename << ": invalid stop \"" << line << "\"" << std::endl;
+			continue;
+		}
+		position -= std::floor(position);
+		loaded.push_back({position, {red / 255.0f, green / 255.0f, blue / 255.0f}});
+	}
+	if (loaded.empty())
+		return false;
+	std::stable_sort(loaded.begin(), loaded.end(), [](const std::pair<float, cl_float3> &a, const std::pair<float, cl_float3> &b)
+	{
+		return a.first < b.first;
+	});
+	stops = loaded;
+	const size_t slash = filename.find_last_of('/');
+	name = filename.substr(slash == std::string::npos ? 0 : slash + 1);
+	name = name.substr(0, name.rfind('.'));
+	return true;
+}
+
+const std::string &Palette::getName() const
+{
+	return name;
+}
+
+std::vector<cl_float4> Palette::bake(const cl_float3 &color) const
+{
+	std::vector<cl_float4> table(SIZE);
+	for (size_t i = 0; i < SIZE; ++i)
+	{
+		const float co = i * PERIOD / SIZE;
+		if (stops.empty())
+		{
+			// the cosine palette of the kernel, based on one from Inigo Quilez's Shader Toy. Its sine term is quadratic in
+			// the coordinate and can't be stored in a repeating table
+			for (int c = 0; c < 3; ++c)
+				table[i].s[c] = 0.5f + 0.5f * std::cos(6.2831f * co + color.s[c]);
+			table[i].s[3] = 1.0f;
+			continue;
+		}
+		// the stops around the rotated position, wrapping around at both ends
+		float u = (float) i / SIZE + color.s[0] / 6.2831f;
+		u -= std::floor(u);
+		size_t next = 0;
+		while (next < stops.size() && stops[next].first <= u)
+			++next;
+		const auto &a = stops[(next + stops.size() - 1) % stops.size()];
+		const auto &b = stops[next % stops.size()];
+		float span = b.first - a.first;
+		float offset = u - a.first;
+		if (span <= 0.0f)
+			span += 1.0f;
+		if (offset < 0.0f)
+			offset += 1.0f;
+		const float f = span > 0.0f ? std::min(offset / span, 1.0f) : 0.0f;
+		for (int c = 0; c < 3; ++c)
+			table[i].s[c] = a.second.s[c] + f * (b.second.s[c] - a.second.s[c]);
+		table[i].s[3] = 1.0f;
+	}
+	return table;
+}
+
+void Palette::upload(cl::CommandQueue &queue, const cl::Image1D &image, const cl_float3 &color) const
+{
+	std::vector<cl_float4> table = bake(color);
+	cl::size_t<3> origin;
+	cl::size_t<3> region;
+	region[0] = SIZE;
+	region[1] = 1;
+	region[2] = 1;
+	queue.enqueueWriteImage(image, CL_TRUE, origin, region, 0, 0, table.data());
+}
+
+cl::Image1D Palette::createImage(const cl::Context &context)
+{
+	return cl::Image1D(context, CL_MEM_READ_ONLY, cl::ImageFormat(CL_RGBA, CL_FLOAT), SIZE);
+}
+
+std::vector<Palette> Palette::list(const std::string &directory)
+{
+	std::vector<std::string> filenames;
+	if (DIR *dir = opendir(directory.c_str()))
+	{
+		while (dirent *entry = readdir(dir))
+		{
+			const std::string filename = entry->d_name;
+			const std::string extension = ".gradient";
+			if (filename.size() > extension.size() && filename.compare(filename.size() - extension.size(), extension.size(), extension) == 0)
+				filenames.push_back(directory + "/" + filename);
+		}
+		closedir(dir);
+	}
+	std::sort(filenames.begin(), filenames.end());
+
+	std::vector<Palette> palettes(1);
+	for (const std::string &filename : filenames)
+	{
+		Palette palette;
+		if (palette.load(filename))
+			palettes.push_back(palette);
+		else
+			std::cerr << "[Palette] couldn't load " << filename << std::endl;
+	}
+	return palettes;
+}
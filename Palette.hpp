@@ -0,0 +1,68 @@
+#pragma once
+
+#define __CL_ENABLE_EXCEPTIONS
+
+#include <CL/cl.hpp>
+#include <string>
+#include <vector>
+#include <utility>
+
+/**
+ * color lookup table of the escaped pixels, the kernels (always built with PALETTE_TABLE) read it with one linearly
+ * filtered fetch instead of evaluating the cosine palette. The table covers PERIOD of the palette coordinate and
+ * repeats. It is either the cosine palette of the kernels without its quadratic sine term, or a gradient loaded from a
+ * file
+ */
+class Palette
+{
+public:
+	// colors of the table, has to match the size of the palette image
+	static const size_t SIZE = 1024;
+	// palette coordinates covered by the table, has to match PALETTE_PERIOD in the kernel. The cosine terms of the
+	// cosine palette repeat after 1, its quadratic sine term never does and is left out of the table
+	static constexpr float PERIOD = 1.0f;
+
+private:
+	std::string name;
+	// (position in [0, 1), RGB in [0, 1]) sorted by position, empty for the cosine palette
+	std::vector<std::pair<float, cl_float3>> stops;
+
+public:
+	/**
+	 * the cosine palette
+	 */
+	Palette();
+
+	/**
+	 * loads a gradient file, one stop per line "{position} {red} {green} {blue}" with the position in [0, 1) and the
+	 * colors in [0, 255], lines starting with # are skipped. The colors are interpolated linearly between the stops
+	 * and from the last one back to the first. The name is the filename without directory and extension
+	 *
+	 * @return false if the file couldn't be read or has no stops
+	 */
+	bool load(const std::string &filename);
+
+	const std::string &getName() const;
+
+	/**
+	 * @param color the phases of the cosine palette, gradients are rotated by color.x / 2pi instead
+	 * @return SIZE RGBA colors for the palette coordinates i * PERIOD / SIZE
+	 */
+	std::vector<cl_float4> bake(const cl_float3 &color) const;
+
+	/**
+	 * writes the table baked with the color into an image of createImage, blocking
+	 */
+	void upload(cl::CommandQueue &queue, const cl::Image1D &image, const cl_float3 &color) const;
+
+	/**
+	 * @return an image of SIZE RGBA float texels for the paletteTable argument of the kernels
+	 */
+	static cl::Image1D createImage(const cl::Context &context);
+
+	/**
+	 * @return the cosine palette followed by the gradients of all *.gradient files in the directory sorted by name,
+	 * files that can't be read are skipped
+	 */
+	static std::vector<Palette> list(const std::string &directory);
+};
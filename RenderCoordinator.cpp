@@ -0,0 +1,243 @@
+#include <iostream>
+#include <algorithm>
+#include <cstring>
+#include <SDL2/SDL.h>
+#include <sys/socket.h>
+#include <poll.h>
+#include <unistd.h>
+#include "RenderCoordinator.hpp"
+
+using cluster::TILE_SIZE;
+
+// tiles per assignment, a worker has at most QUEUED_BATCHES assignments outstanding so it never runs dry
+static const size_t BATCH = 4;
+static const size_t QUEUED_BATCHES = 2;
+// workers rendering the same tile at most, the first result is used
+static const unsigned char MAX_COPIES = 2;
+static const size_t MAX_MESSAGE = sizeof(cluster::TileIndex) + TILE_SIZE * TILE_SIZE * 4;
+static const std::chrono::seconds REPORT_INTERVAL(1);
+
+RenderCoordinator::RenderCoordinator(const std::string &address, const cluster::ViewMessage &view) : address(address),
+                                                                                                     view(view), joined(0)
+{
+	tilesX = (view.width + TILE_SIZE - 1) / TILE_SIZE;
+	tilesY = (view.height + TILE_SIZE - 1) / TILE_SIZE;
+	for (size_t tile = 0; tile < tilesX * tilesY; ++tile)
+		pending.push_back(tile);
+	finished.assign(tilesX * tilesY, false);
+	copies.assign(tilesX * tilesY, 0);
+	remaining = tilesX * tilesY;
+	image.assign(view.width * view.height * 4, 0);
+}
+
+bool RenderCoordinator::run(const std::string &filename)
+{
+	const int listener = cluster::listenOn(address);
+	if (listener < 0)
+		return false;
+	std::cout << "[RenderCoordinator] rendering " << view.width << "x" << view.height << " in " << remaining <<
+	" tiles, waiting for workers on " << address << std::endl;
+
+	const auto start = std::chrono::steady_clock::now();
+	auto lastReport = start;
+	std::vector<pollfd> fds;
+	while (remaining > 0)
+	{
+		fds.assign(1, {listener, POLLIN, 0});
+		for (const auto &worker : workers)
+			fds.push_back({worker.socket, POLLIN, 0});
+		if (poll(fds.data(), fds.size(), 1000) < 0)
+			continue;
+
+		// the workers polled are the first fds.size() - 1, accepted ones are appended behind them
+		for (size_t i = fds.size() - 1; i-- > 0;)
+			if (fds[i + 1].revents && !receive(workers[i]))
+				drop(i);
+		if (fds[0].revents & POLLIN)
+		{
+			const int connection = accept(listener, nullptr, nullptr);
+			if (connection >= 0 && cluster::sendMessage(connection, cluster::VIEW, &view, sizeof(view)))
+				workers.push_back({connection, "worker " + std::to_string(++joined), std::vector<char>(), 0,
+				                   std::vector<Assignment>(), 0, 0});
+			else if (connection >= 0)
+				close(connection);
+		}
+		for (size_t i = workers.size(); i-- > 0;)
+			if (!assign(workers[i]))
+				drop(i);
+
+		const auto now = std::chrono::steady_clock::now();
+		if (now - lastReport >= REPORT_INTERVAL)
+		{
+			std::cout << "[RenderCoordinator] " << tilesX * tilesY - remaining << "/" << tilesX * tilesY << " tiles, " <<
+			workers.size() << " workers" << std::endl;
+			lastReport = now;
+		}
+	}
+	const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	for (const auto &worker : workers)
+	{
+		cluster::sendMessage(worker.socket, cluster::DONE);
+		close(worker.socket);
+		std::cout << "[RenderCoordinator]   " << worker.name << ": " << worker.tiles << " tiles, " << worker.duplicates <<
+		" late copies" << std::endl;
+	}
+	workers.clear();
+	close(listener);
+	if (address.compare(0, 5, "unix:") == 0)
+		unlink(address.substr(5).c_str());
+	std::cout << "[RenderCoordinator] " << tilesX * tilesY << " tiles in " << seconds << "s, " << tilesX * tilesY / seconds <<
+	" tiles/s" << std::endl;
+	return saveImage(filename);
+}
+
+bool RenderCoordinator::receive(Worker &worker)
+{
+	// the header is read first, then the payload it announces
+	cluster::MessageHeader header;
+	size_t needed = sizeof(header);
+	if (worker.received >= sizeof(header))
+	{
+		std::memcpy(&header, worker.input.data(), sizeof(header));
+		needed += header.size;
+	}
+	worker.input.resize(needed);
+	const ssize_t n = recv(worker.socket, worker.input.data() + worker.received, needed - worker.received, 0);
+	if (n <= 0)
+		return false;
+	worker.received += n;
+	if (worker.received < needed)
+		return true;
+	std::memcpy(&header, worker.input.data(), sizeof(header));
+	if (needed == sizeof(header))
+	{
+		if (header.size > MAX_MESSAGE)
+			return false;
+		if (header.size > 0)
+			return true;
+	}
+
+	const char *payload = worker.input.data() + sizeof(header);
+	worker.received = 0;
+	if (header.type == cluster::HELLO)
+	{
+		worker.name += " (" + std::string(payload, header.size) + ")";
+		std::cout << "[RenderCoordinator] " << worker.name << " joined" << std::endl;
+		return true;
+	}
+	if (header.type == cluster::TILE && header.size == MAX_MESSAGE)
+	{
+		cluster::TileIndex index;
+		std::memcpy(&index, payload, sizeof(index));
+		if (index.x >= tilesX || index.y >= tilesY)
+			return false;
+		handleTile(worker, index, (const unsigned char *) payload + sizeof(index));
+		return true;
+	}
+	std::cerr << "[RenderCoordinator] unexpected message " << header.type << " from " << worker.name << std::endl;
+	return false;
+}
+
+void RenderCoordinator::handleTile(Worker &worker, const cluster::TileIndex &index, const unsigned char *rgba)
+{
+	const size_t tile = index.y * tilesX + index.x;
+	auto assignment = std::find_if(worker.outstanding.begin(), worker.outstanding.end(),
+	                               [tile](const Assignment &a) { return a.tile == tile; });
+	if (assignment != worker.outstanding.end())
+	{
+		worker.outstanding.erase(assignment);
+		--copies[tile];
+	}
+	if (finished[tile])
+	{
+		++worker.duplicates;
+		return;
+	}
+	finished[tile] = true;
+	--remaining;
+	++worker.tiles;
+
+	// the tiles on the right and top border reach past the image
+	const size_t x0 = index.x * TILE_SIZE;
+	const size_t columns = std::min((size_t) TILE_SIZE, view.width - x0);
+	for (size_t row = 0; row < TILE_SIZE && index.y * TILE_SIZE + row < view.height; ++row)
+		std::memcpy(&image[((index.y * TILE_SIZE + row) * view.width + x0) * 4], rgba + row * TILE_SIZE * 4, columns * 4);
+}
+
+bool RenderCoordinator::assign(Worker &worker)
+{
+	const auto now = std::chrono::steady_clock::now();
+	std::vector<size_t> batch;
+	while (!pending.empty() && worker.outstanding.size() + batch.size() < QUEUED_BATCHES * BATCH)
+	{
+		if (!finished[pending.front()])
+			batch.push_back(pending.front());
+		pending.pop_front();
+	}
+	if (batch.empty() && worker.outstanding.empty())
+	{
+		// nothing is queued, render the tiles the others have been working on the longest as well
+		std::vector<Assignment> candidates;
+		for (const auto &other : workers)
+			if (&other != &worker)
+				for (const auto &a : other.outstanding)
+					if (!finished[a.tile] && copies[a.tile] < MAX_COPIES)
+						candidates.push_back(a);
+		std::sort(candidates.begin(), candidates.end(), [](const Assignment &a, const Assignment &b) { return a.time < b.time; });
+		for (size_t i = 0; i < candidates.size() && batch.size() < BATCH; ++i)
+			if (std::find(batch.begin(), batch.end(), candidates[i].tile) == batch.end())
+				batch.push_back(candidates[i].tile);
+	}
+	if (batch.empty())
+		return true;
+
+	std::vector<cluster::TileIndex> indices;
+	for (size_t tile : batch)
+	{
+		worker.outstanding.push_back({tile, now});
+		++copies[tile];
+		indices.push_back({(uint32_t) (tile % tilesX), (uint32_t) (tile / tilesX)});
+	}
+	return cluster::sendMessage(worker.socket, cluster::ASSIGN, indices.data(), indices.size() * sizeof(cluster::TileIndex));
+}
+
+void RenderCoordinator::drop(size_t workerIndex)
+{
+	Worker &worker = workers[workerIndex];
+	size_t requeued = 0;
+	for (const auto &a : worker.outstanding)
+		if (--copies[a.tile] == 0 && !finished[a.tile])
+		{
+			pending.push_front(a.tile);
+			++requeued;
+		}
+	std::cout << "[RenderCoordinator] lost " << worker.name << " after " << worker.tiles << " tiles, " << requeued <<
+	" tiles queued again" << std::endl;
+	close(worker.socket);
+	workers.erase(workers.begin() + workerIndex);
+}
+
+bool RenderCoordinator::saveImage(const std::string &filename) const
+{
+	// the rows are stored from the bottom up, so the imaginary axis points up in the image
+	std::vector<unsigned char> flipped(image.size());
+	for (size_t y = 0; y < view.height; ++y)
+		std::memcpy(&flipped[y * view.width * 4], &image[(view.height - 1 - y) * view.width * 4], view.width * 4);
+
+	// the bytes are R, G, B, A in memory
+#if SDL_BYTEORDER == SDL_BIG_ENDIAN
+	SDL_Surface *surface = SDL_CreateRGBSurfaceFrom(flipped.data(), view.width, view.height, 32, 4 * view.width, 0xFF000000,
+	                                                0x00FF0000, 0x0000FF00, 0x000000FF);
+#else
+	SDL_Surface *surface = SDL_CreateRGBSurfaceFrom(flipped.data(), view.width, view.height, 32, 4 * view.width, 0x000000FF,
+	                                                0x0000FF00, 0x00FF0000, 0xFF000000);
+#endif
+	const bool saved = surface && SDL_SaveBMP(surface, filename.c_str()) == 0;
+	SDL_FreeSurface(surface);
+	if (saved)
+		std::cout << "[RenderCoordinator] saved " << filename << std::endl;
+	else
+		std::cerr << "[RenderCoordinator] couldn't save " << filename << ": " << SDL_GetError() << std::endl;
+	return saved;
+}
@@ -0,0 +1,85 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <chrono>
+#include "ClusterProtocol.hpp"
+
+/**
+ * coordinator of a distributed render. It splits the view into tiles, hands them to the RenderWorkers connected to
+ * its socket in small batches and assembles the tiles they stream back into one image. Workers can join at any time,
+ * the tiles of a worker that disconnects are queued again, and once the queue is empty idle workers render copies of
+ * the tiles that have been outstanding the longest, so a straggler can't hold up the image
+ */
+class RenderCoordinator
+{
+private:
+	struct Assignment
+	{
+		size_t tile;
+		std::chrono::steady_clock::time_point time;
+	};
+
+	struct Worker
+	{
+		int socket;
+		std::string name;
+		// bytes of the message that is being received
+		std::vector<char> input;
+		size_t received;
+		std::vector<Assignment> outstanding;
+		size_t tiles;
+		size_t duplicates;
+	};
+
+	std::string address;
+	cluster::ViewMessage view;
+	size_t tilesX;
+	size_t tilesY;
+
+	std::vector<Worker> workers;
+	// workers that connected so far, names them
+	size_t joined;
+	// tiles that haven't been assigned yet
+	std::deque<size_t> pending;
+	std::vector<bool> finished;
+	// workers the tile is assigned to
+	std::vector<unsigned char> copies;
+	size_t remaining;
+	// RGBA8, rows from the bottom up
+	std::vector<unsigned char> image;
+
+	/**
+	 * reads what arrived on the socket of the worker and handles the complete messages
+	 *
+	 * @return false if the worker disconnected or violated the protocol
+	 */
+	bool receive(Worker &worker);
+
+	void handleTile(Worker &worker, const cluster::TileIndex &index, const unsigned char *rgba);
+
+	/**
+	 * keeps the worker busy with queued tiles, or with copies of the oldest outstanding tiles of the others
+	 *
+	 * @return false if the connection was lost
+	 */
+	bool assign(Worker &worker);
+
+	/**
+	 * queues the unfinished tiles of the worker again and closes its connection
+	 */
+	void drop(size_t workerIndex);
+
+	bool saveImage(const std::string &filename) const;
+
+public:
+	RenderCoordinator(const std::string &address, const cluster::ViewMessage &view);
+
+	/**
+	 * listens on the address until all tiles are rendered, then releases the workers and saves the image as BMP
+	 *
+	 * @return false if the address can't be used or the image can't be saved
+	 */
+	bool run(const std::string &filename);
+};
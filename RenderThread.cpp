@@ -0,0 +1,333 @@
+#include <iostream>
+#include <sstream>
+#include <ctime>
+#include <vector>
+#include <cstring>
+#include "RenderThread.hpp"
+
+// cells per side of the Julia grid and their edge length in pixels
+static const size_t JULIA_GRID = 16;
+static const size_t JULIA_CELL = 128;
+
+RenderThread::View::View(size_t width, size_t height) : width(width), height(height), zoom(1.0), pos({0.0, 0.0}),
+                                                        iterations(300), color({0.0f, 0.0f, 0.0f}), colorMode(SMOOTH),
+                                                        renderMode(DIRECT), tileCacheBudget(0), importanceSampling(true), workCounters(false),
+                                                        sampleTarget(1024), noiseThreshold(0.001), toneCurve(LINEAR),
+                                                        saveRequests(0), exportRequests(0), juliaGridRequests(0), sequence(0)
+{ }
+
+RenderThread::Frame::Frame() : texture(0), width(0), height(0), sampleCount(0), sequence(0), index(0)
+{ }
+
+RenderThread::RenderThread(SDL_Window *window, const View &view, const std::string &formula,
+                           const std::string &sourceFilename) : window(window), formula(formula),
+                                                                sourceFilename(sourceFilename), running(true),
+                                                                idle(false), current(view), presented(0)
+{
+	idleEvent = SDL_RegisterEvents(1);
+	SDL_GLContext mainContext = SDL_GL_GetCurrentContext();
+	SDL_GL_SetAttribute(SDL_GL_SHARE_WITH_CURRENT_CONTEXT, 1);
+	context = SDL_GL_CreateContext(window);
+	if (!context)
+	{
+		std::cerr << "[RenderThread] couldn't create a shared GL context: " << SDL_GetError() << std::endl;
+		exit(EXIT_FAILURE);
+	}
+	// creating the context made it current, the event loop keeps drawing with its own
+	SDL_GL_MakeCurrent(window, mainContext);
+	post(view);
+	thread = std::thread(&RenderThread::run, this);
+}
+
+RenderThread::~RenderThread()
+{
+	{
+		std::lock_guard<std::mutex> lock(idleMutex);
+		running = false;
+	}
+	wake.notify_one();
+	thread.join();
+	SDL_GL_DeleteContext(context);
+}
+
+void RenderThread::post(const View &view)
+{
+	views.back() = view;
+	views.publish();
+	{
+		std::lock_guard<std::mutex> lock(idleMutex);
+		idle = false;
+	}
+	wake.notify_one();
+}
+
+bool RenderThread::isIdle()
+{
+	std::lock_guard<std::mutex> lock(idleMutex);
+	return idle;
+}
+
+const RenderThread::Frame &RenderThread::latestFrame()
+{
+	frames.update();
+	return frames.front();
+}
+
+void RenderThread::run()
+{
+	SDL_GL_MakeCurrent(window, context);
+	views.update();
+	current = views.front();
+	oclRenderer.reset(new OCLRenderer(current.width, current.height, 0, formula, sourceFilename));
+	// start from the defaults of the renderer, apply sets everything the view changes
+	const View &view = views.front();
+	current.formula = oclRenderer->getFormula();
+	current.zoom = oclRenderer->getZoom();
+	current.pos = oclRenderer->getPos();
+	current.iterations = oclRenderer->getIterations();
+	current.color = oclRenderer->getColor();
+	current.palette = oclRenderer->getPalette();
+	current.colorMode = oclRenderer->getColorMode();
+	current.renderMode = oclRenderer->getRenderMode();
+	current.tileCacheBudget = 0;
+	current.importanceSampling = oclRenderer->isImportanceSampling();
+	current.workCounters = oclRenderer->isCountingWork();
+	current.sampleTarget = oclRenderer->getSampleTarget();
+	current.noiseThreshold = oclRenderer->getNoiseThreshold();
+	apply(view);
+
+	glGenFramebuffers(2, framebuffers);
+	Frame *slots = frames.data();
+	for (size_t i = 0; i < 3; ++i)
+		glGenTextures(1, &slots[i].texture);
+
+	bool refresh = true;
+	while (running)
+	{
+		// a newer view makes the sample in progress stale, it is dropped instead of finished
+		if (views.update())
+			refresh = apply(views.front()) || refresh;
+		if (refresh || !oclRenderer->isConverged())
+		{
+			oclRenderer->render(refresh);
+			refresh = false;
+			present();
+		}
+		// more samples wouldn't change the image, the device is left alone until the view changes
+		else if (waitForView())
+		{
+			refresh = apply(views.front());
+			// a view that doesn't change the image is still answered with a frame, so its latency can be measured
+			if (!refresh)
+				present();
+		}
+
+		if (views.front().saveRequests != current.saveRequests)
+			saveRenderedImage(views.front().toneCurve);
+		if (views.front().exportRequests != current.exportRequests)
+		{
+			std::ostringstream filename;
+			filename << "field_" << time(nullptr) << ".mbf";
+			oclRenderer->exportIterationField(filename.str());
+		}
+		if (views.front().juliaGridRequests != current.juliaGridRequests)
+			saveJuliaGrid();
+		current.saveRequests = views.front().saveRequests;
+		current.exportRequests = views.front().exportRequests;
+		current.juliaGridRequests = views.front().juliaGridRequests;
+	}
+
+	oclRenderer.reset();
+	for (size_t i = 0; i < 3; ++i)
+		glDeleteTextures(1, &slots[i].texture);
+	glDeleteFramebuffers(2, framebuffers);
+	SDL_GL_MakeCurrent(window, nullptr);
+}
+
+bool RenderThread::apply(const View &view)
+{
+	bool changed = false;
+	if (view.width != current.width || view.height != current.height)
+	{
+		oclRenderer->reshape(view.width, view.height);
+		changed = true;
+	}
+	if (view.zoom != current.zoom)
+	{
+		oclRenderer->setZoom(view.zoom);
+		changed = true;
+	}
+	if (view.pos.s[0] != current.pos.s[0] || view.pos.s[1] != current.pos.s[1])
+	{
+		oclRenderer->setPos(view.pos.s[0], view.pos.s[1]);
+		changed = true;
+	}
+	if (view.iterations != current.iterations)
+	{
+		oclRenderer->setIterations(view.iterations);
+		changed = true;
+	}
+	if (view.color.s[0] != current.color.s[0] || view.color.s[1] != current.color.s[1] ||
+	    view.color.s[2] != current.color.s[2])
+	{
+		oclRenderer->setColor(view.color);
+		changed = true;
+	}
+	if (view.palette.getName() != current.palette.getName())
+	{
+		oclRenderer->setPalette(view.palette);
+		changed = true;
+	}
+	if (view.colorMode != current.colorMode)
+	{
+		oclRenderer->setColorMode(view.colorMode);
+		changed = true;
+	}
+	if (view.renderMode != current.renderMode)
+	{
+		oclRenderer->setRenderMode(view.renderMode);
+		changed = true;
+	}
+	if (view.tileCacheBudget != current.tileCacheBudget)
+	{
+		oclRenderer->setTileCache(view.tileCacheBudget);
+		changed = true;
+	}
+	if (view.importanceSampling != current.importanceSampling)
+	{
+		oclRenderer->setImportanceSampling(view.importanceSampling);
+		changed = true;
+	}
+	// the formula is built in the background, the renderer restarts the image once it switches
+	if (!view.formula.empty() && view.formula != current.formula)
+		oclRenderer->setFormula(view.formula);
+	// counting doesn't change the image and neither does the target, a higher one continues it
+	if (view.workCounters != current.workCounters)
+		oclRenderer->setWorkCounters(view.workCounters);
+	if (view.sampleTarget != current.sampleTarget || view.noiseThreshold != current.noiseThreshold)
+		oclRenderer->setConvergenceTarget(view.sampleTarget, view.noiseThreshold);
+	// the requests are handled after the next launch
+	const unsigned saveRequests = current.saveRequests;
+	const unsigned exportRequests = current.exportRequests;
+	const unsigned juliaGridRequests = current.juliaGridRequests;
+	current = view;
+	if (view.formula.empty())
+		current.formula = oclRenderer->getFormula();
+	current.saveRequests = saveRequests;
+	current.exportRequests = exportRequests;
+	current.juliaGridRequests = juliaGridRequests;
+	return changed;
+}
+
+bool RenderThread::waitForView()
+{
+	// a view posted since the last check doesn't wake the thread anymore
+	std::unique_lock<std::mutex> lock(idleMutex);
+	if (views.update())
+		return true;
+	if (!running)
+		return false;
+	idle = true;
+	std::cout << "[RenderThread] converged after " << oclRenderer->getSampleCount() << " samples, " <<
+	oclRenderer->getNoise() * 100.0 << "% of the pixels changed with the last one" << std::endl;
+	SDL_Event event;
+	SDL_zero(event);
+	event.type = idleEvent;
+	SDL_PushEvent(&event);
+	wake.wait(lock, [this] { return !idle || !running; });
+	return views.update();
+}
+
+void RenderThread::present()
+{
+	Frame &frame = frames.back();
+	const Texture &texture = oclRenderer->getTexture();
+	if (frame.width != texture.width || frame.height != texture.height)
+	{
+		frame.width = texture.width;
+		frame.height = texture.height;
+		glBindTexture(GL_TEXTURE_2D, frame.texture);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, frame.width, frame.height, 0, GL_RGBA, GL_FLOAT, NULL);
+		glBindTexture(GL_TEXTURE_2D, 0);
+	}
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, framebuffers[0]);
+	glFramebufferTexture2D(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, texture.id, 0);
+	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, framebuffers[1]);
+	glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, frame.texture, 0);
+	glBlitFramebuffer(0, 0, frame.width, frame.height, 0, 0, frame.width, frame.height, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	// the copy has to be complete before the other context draws the frame
+	glFinish();
+	frame.sampleCount = oclRenderer->getSampleCount();
+	frame.sequence = current.sequence;
+	frame.index = ++presented;
+	frames.publish();
+}
+
+void RenderThread::saveRenderedImage(ToneCurve toneCurve)
+{
+	// save the rendered image, resolved and tone mapped by the device
+	size_t width = oclRenderer->getTexture().width;
+	size_t height = oclRenderer->getTexture().height;
+	auto pixels = oclRenderer->getImage(toneCurve);
+
+	// the bytes are R, G, B, A in memory
+#if SDL_BYTEORDER == SDL_BIG_ENDIAN
+	SDL_Surface *image = SDL_CreateRGBSurfaceFrom((void *) pixels.get(), width, height, 32, 4 * width, 0xFF000000, 0x00FF0000,
+	                                              0x0000FF00, 0x000000FF);
+#else
+	SDL_Surface *image = SDL_CreateRGBSurfaceFrom((void *) pixels.get(), width, height, 32, 4 * width, 0x000000FF, 0x0000FF00,
+	                                              0x00FF0000, 0xFF000000);
+#endif
+	std::ostringstream stringStream;
+	stringStream << "render_" << time(nullptr) << "_" << oclRenderer->getSampleCount() << "SPP.bmp";
+	SDL_SaveBMP(image, stringStream.str().c_str());
+	SDL_FreeSurface(image);
+}
+
+void RenderThread::saveJuliaGrid()
+{
+	const size_t width = oclRenderer->getTexture().width;
+	const size_t height = oclRenderer->getTexture().height;
+	const cl_double zoom = oclRenderer->getZoom();
+	const cl_double2 pos = oclRenderer->getPos();
+
+	// the c of cell (x, y) is the center of the corresponding part of the view, every cell shows [-2, 2]^2
+	std::vector<Viewport> viewports;
+	for (size_t y = 0; y < JULIA_GRID; ++y)
+		for (size_t x = 0; x < JULIA_GRID; ++x)
+			viewports.push_back({{(cl_real) -2.0, (cl_real) -2.0},
+			                     {(cl_real) (zoom * ((x + 0.5) / JULIA_GRID + pos.s[0])),
+			                      (cl_real) (zoom * ((y + 0.5) / JULIA_GRID * height / width + pos.s[1]))},
+			                     (cl_real) 4.0, oclRenderer->getIterations()});
+	auto cells = oclRenderer->renderViewports("julia_set", viewports, JULIA_CELL);
+	if (!cells)
+		return;
+
+	// the cells are rendered with the imaginary axis pointing up, the image rows go down
+	const size_t size = JULIA_GRID * JULIA_CELL;
+	std::vector<cl_uchar> pixels(size * size * 4);
+	for (size_t cell = 0; cell < viewports.size(); ++cell)
+		for (size_t row = 0; row < JULIA_CELL; ++row)
+		{
+			const size_t y = size - 1 - ((cell / JULIA_GRID) * JULIA_CELL + row);
+			std::memcpy(&pixels[(y * size + (cell % JULIA_GRID) * JULIA_CELL) * 4],
+			            cells.get() + (cell * JULIA_CELL + row) * JULIA_CELL * 4, JULIA_CELL * 4);
+		}
+	cells.reset();
+
+#if SDL_BYTEORDER == SDL_BIG_ENDIAN
+	SDL_Surface *image = SDL_CreateRGBSurfaceFrom(pixels.data(), size, size, 32, 4 * size, 0xFF000000, 0x00FF0000, 0x0000FF00,
+	                                              0x000000FF);
+#else
+	SDL_Surface *image = SDL_CreateRGBSurfaceFrom(pixels.data(), size, size, 32, 4 * size, 0x000000FF, 0x0000FF00, 0x00FF0000,
+	                                              0xFF000000);
+#endif
+	std::ostringstream stringStream;
+	stringStream << "julia_grid_" << time(nullptr) << ".bmp";
+	SDL_SaveBMP(image, stringStream.str().c_str());
+	SDL_FreeSurface(image);
+	std::cout << "[RenderThread] saved " << stringStream.str() << std::endl;
+}
@@ -0,0 +1,172 @@
+#pragma once
+
+#include <GL/glew.h>
+#include <SDL2/SDL.h>
+#include <string>
+#include <memory>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include "OCLRenderer.hpp"
+#include "Mailbox.hpp"
+
+/**
+ * runs the OpenCL renderer on its own thread with its own GL context shared with the window context, so the event
+ * loop never waits for a launch. The event loop posts the latest view, the render thread presents every finished
+ * launch as a frame and the event loop draws the newest frame. Once the image reaches the convergence target the
+ * thread stops launching and sleeps until the next view
+ */
+class RenderThread
+{
+public:
+	/**
+	 * everything the event loop controls, the render thread only ever sees the latest posted view
+	 */
+	struct View
+	{
+		size_t width;
+		size_t height;
+		// selected formula, empty keeps the one the thread was started with
+		std::string formula;
+		double zoom;
+		cl_double2 pos;
+		cl_int iterations;
+		cl_float3 color;
+		Palette palette;
+		ColorMode colorMode;
+		RenderMode renderMode;
+		// bytes of tiles kept in memory, 0 disables the tile cache
+		size_t tileCacheBudget;
+		// draw the c of the orbit density mode near the boundary
+		bool importanceSampling;
+		// print the work counters of every launch
+		bool workCounters;
+		// convergence target of the image, see OCLRenderer::setConvergenceTarget
+		cl_int sampleTarget;
+		double noiseThreshold;
+		// tone curve of saved images
+		ToneCurve toneCurve;
+		// incremented to save the image, export the iteration field of the view or save a grid of the Julia sets
+		// of the c in the view
+		unsigned saveRequests;
+		unsigned exportRequests;
+		unsigned juliaGridRequests;
+		// set by the poster to identify the view, frames carry the one of the view they show
+		unsigned sequence;
+
+		View(size_t width = 0, size_t height = 0);
+	};
+
+	/**
+	 * a finished launch copied to a texture of the shared context
+	 */
+	struct Frame
+	{
+		GLuint texture;
+		size_t width;
+		size_t height;
+		int sampleCount;
+		// sequence of the view the frame shows
+		unsigned sequence;
+		// counts the frames the render thread presented
+		unsigned long index;
+
+		Frame();
+	};
+
+private:
+	SDL_Window *window;
+	SDL_GLContext context;
+	std::string formula;
+	std::string sourceFilename;
+
+	Mailbox<View> views;
+	Mailbox<Frame> frames;
+	std::atomic<bool> running;
+	std::thread thread;
+	// set while the thread waits for a view because the image is done, cleared by post
+	bool idle;
+	std::mutex idleMutex;
+	std::condition_variable wake;
+	// pushed to the event queue when the thread goes idle, so the event loop draws the last frame
+	Uint32 idleEvent;
+
+	// only used on the render thread
+	std::shared_ptr<OCLRenderer> oclRenderer;
+	View current;
+	// read and draw framebuffer of the copy to the frames
+	GLuint framebuffers[2];
+	unsigned long presented;
+
+	/**
+	 * renders the latest view until the thread is stopped, a newer view discards the sample in progress at the
+	 * next launch
+	 */
+	void run();
+
+	/**
+	 * brings the renderer to the view
+	 *
+	 * @return true if the image changed and has to be started again
+	 */
+	bool apply(const View &view);
+
+	/**
+	 * sleeps until a view is posted or the thread is stopped
+	 *
+	 * @return true if there is a new view
+	 */
+	bool waitForView();
+
+	/**
+	 * copies the texture of the renderer to the back frame and hands it to the event loop
+	 */
+	void present();
+
+	/**
+	 * saves a screencapture in the current directory with the following name scheme:
+	 * render_{CURRENT_TIME}_{SAMPLE_COUNT}_Spp.bmp
+	 */
+	void saveRenderedImage(ToneCurve toneCurve);
+
+	/**
+	 * renders the Julia sets of a grid of c covering the view in one launch and saves them as one image with the
+	 * name scheme julia_grid_{CURRENT_TIME}.bmp
+	 */
+	void saveJuliaGrid();
+
+public:
+	/**
+	 * creates the shared GL context on the calling thread, whose context has to be current, and starts rendering
+	 * the view
+	 */
+	RenderThread(SDL_Window *window, const View &view, const std::string &formula = "mandelbrot",
+	             const std::string &sourceFilename = "kernels/default.cl");
+
+	/**
+	 * stops the thread after the launch in progress
+	 */
+	~RenderThread();
+
+	RenderThread(const RenderThread &) = delete;
+
+	RenderThread &operator=(const RenderThread &) = delete;
+
+	/**
+	 * replaces the view, a view that wasn't picked up yet is dropped. Only called from one thread
+	 */
+	void post(const View &view);
+
+	/**
+	 * @return true if the image is done and the thread waits for the next view, the event loop can block on its
+	 * events until then. An event is pushed when the thread goes idle
+	 */
+	bool isIdle();
+
+	/**
+	 * @return the newest frame, its texture stays valid until the next call. The width is 0 before the first frame.
+	 * Only called from one thread
+	 */
+	const Frame &latestFrame();
+};
@@ -0,0 +1,208 @@
+#include <iostream>
+#include <fstream>
+#include <thread>
+#include <vector>
+#include <chrono>
+#include <algorithm>
+#include <cstring>
+#include <unistd.h>
+#include "RenderWorker.hpp"
+#include "CLUtils.hpp"
+
+using cluster::TILE_SIZE;
+
+static const std::chrono::milliseconds CONNECT_RETRY(200);
+static const size_t CONNECT_ATTEMPTS = 150;
+
+RenderWorker::RenderWorker(int deviceIndex, const std::string &partition, const std::string &sourceFilename) : sourceFilename(sourceFilename)
+{
+	std::memset(&view, 0, sizeof(view));
+	try
+	{
+		device = cl::headlessDevice(deviceIndex);
+		if (!device())
+		{
+			std::cerr << "[RenderWorker] no such opencl device" << std::endl;
+			exit(EXIT_FAILURE);
+		}
+		if (!partition.empty())
+		{
+			const std::vector<cl::Device> subDevices = cl::partitionDevice(device, partition);
+			if (subDevices.empty())
+			{
+				std::cerr << "[RenderWorker] invalid partition " << partition << std::endl;
+				exit(EXIT_FAILURE);
+			}
+			device = subDevices[0];
+		}
+		context = cl::Context(device);
+		queue = cl::CommandQueue(context, device);
+
+		atlasBuffer = cl::Buffer(context, CL_MEM_READ_WRITE, MAX_BATCH * TILE_SIZE * TILE_SIZE * sizeof(cl_float));
+		// the tiles are sent from the mapped buffer, CPU and integrated devices keep it in host memory
+		const bool unifiedMemory = device.getInfo<CL_DEVICE_HOST_UNIFIED_MEMORY>() == CL_TRUE;
+		rgbaBuffer = cl::Buffer(context, CL_MEM_WRITE_ONLY | (unifiedMemory ? CL_MEM_ALLOC_HOST_PTR : 0),
+		                        MAX_BATCH * TILE_SIZE * TILE_SIZE * sizeof(cl_uchar4));
+		jobsBuffer = cl::Buffer(context, CL_MEM_READ_ONLY, MAX_BATCH * sizeof(cl_long4));
+		paletteImage = Palette::createImage(context);
+	}
+	catch (cl::Error error)
+	{
+		std::cout << error.what() << "(" << cl::errorString(error.err()) << ")" << std::endl;
+		exit(EXIT_FAILURE);
+	}
+}
+
+bool RenderWorker::build(const std::string &formula)
+{
+	const std::string options = OCLRenderer::templateOptions(formula);
+	if (options.empty())
+	{
+		std::cerr << "[RenderWorker] unknown formula " << formula << std::endl;
+		return false;
+	}
+	try
+	{
+		std::ifstream sourcefile(sourceFilename);
+		const std::string source((std::istreambuf_iterator<char>(sourcefile)), std::istreambuf_iterator<char>());
+		program = cl::Program(context, cl::Program::Sources(1, std::make_pair(source.c_str(), source.length() + 1)));
+		try
+		{
+			program.build(std::vector<cl::Device>(1, device), options.c_str());
+		}
+		catch (cl::Error error)
+		{
+			if (error.err() == CL_BUILD_PROGRAM_FAILURE)
+				std::cout << "Build log:" << std::endl << program.getBuildInfo<CL_PROGRAM_BUILD_LOG>(device) << std::endl;
+			throw;
+		}
+		tileRenderFunc.reset(new cl::make_kernel<cl::Buffer &, cl::Buffer &, cl_real2, cl_real, cl_int, cl_real2>(
+				cl::Kernel(program, "tile_render")));
+		cl::Kernel colorizeKernel(program, "tile_colorize");
+		colorizeKernel.setArg(4, paletteImage);
+		tileColorizeFunc.reset(new cl::make_kernel<cl::Buffer &, cl::Buffer &, cl_float3, cl_uint>(colorizeKernel));
+	}
+	catch (cl::Error error)
+	{
+		std::cout << error.what() << "(" << cl::errorString(error.err()) << ")" << std::endl;
+		exit(EXIT_FAILURE);
+	}
+	this->formula = formula;
+	return true;
+}
+
+bool RenderWorker::run(const std::string &address)
+{
+	int socket = -1;
+	for (size_t attempt = 0; socket < 0 && attempt < CONNECT_ATTEMPTS; ++attempt)
+	{
+		socket = cluster::connectTo(address);
+		if (socket < 0)
+			std::this_thread::sleep_for(CONNECT_RETRY);
+	}
+	if (socket < 0)
+	{
+		std::cerr << "[RenderWorker] couldn't connect to " << address << std::endl;
+		return false;
+	}
+	const std::string name = device.getInfo<CL_DEVICE_NAME>();
+	if (!cluster::sendMessage(socket, cluster::HELLO, name.data(), name.size()))
+	{
+		close(socket);
+		return false;
+	}
+	std::cout << "[RenderWorker] rendering for " << address << " on " << name << std::endl;
+
+	size_t tiles = 0;
+	bool done = false;
+	std::vector<char> payload;
+	for (;;)
+	{
+		cluster::MessageHeader header;
+		if (!cluster::receiveAll(socket, &header, sizeof(header)))
+			break;
+		payload.resize(header.size);
+		if (header.size && !cluster::receiveAll(socket, payload.data(), header.size))
+			break;
+
+		if (header.type == cluster::VIEW && header.size == sizeof(view))
+		{
+			std::memcpy(&view, payload.data(), sizeof(view));
+			const std::string viewFormula(view.formula, strnlen(view.formula, sizeof(view.formula)));
+			if (viewFormula != formula && !build(viewFormula))
+				break;
+			try
+			{
+				Palette().upload(queue, paletteImage, {view.color[0], view.color[1], view.color[2]});
+			}
+			catch (cl::Error error)
+			{
+				std::cerr << "[RenderWorker] uploading the palette failed: " << error.what() << "(" << cl::errorString(error.err()) << ")" << std::endl;
+				break;
+			}
+		}
+		else if (header.type == cluster::ASSIGN && !formula.empty())
+		{
+			const size_t count = header.size / sizeof(cluster::TileIndex);
+			const cluster::TileIndex *assigned = (const cluster::TileIndex *) payload.data();
+			bool sent = true;
+			for (size_t i = 0; sent && i < count; i += MAX_BATCH)
+				sent = renderBatch(socket, assigned + i, std::min(MAX_BATCH, count - i));
+			if (!sent)
+				break;
+			tiles += count;
+		}
+		else if (header.type == cluster::DONE)
+		{
+			done = true;
+			break;
+		}
+		else
+		{
+			std::cerr << "[RenderWorker] unexpected message " << header.type << std::endl;
+			break;
+		}
+	}
+	close(socket);
+	std::cout << "[RenderWorker] rendered " << tiles << " tiles" << std::endl;
+	return done;
+}
+
+bool RenderWorker::renderBatch(int socket, const cluster::TileIndex *tiles, size_t count)
+{
+	// level 0 tiles of the view, slot i of the atlas holds tile i
+	std::vector<cl_long4> jobs;
+	for (size_t i = 0; i < count; ++i)
+		jobs.push_back({(cl_long) tiles[i].x, (cl_long) tiles[i].y, 0, (cl_long) i});
+	const cl_uint texels = count * TILE_SIZE * TILE_SIZE;
+	const unsigned char *rgba;
+	try
+	{
+		cl_real2 origin = {(cl_real) (view.zoom * view.posX), (cl_real) (view.zoom * view.posY)};
+		cl_real extent = (cl_real) (view.zoom * TILE_SIZE / view.width);
+		cl_real2 juliaC = {(cl_real) view.juliaCX, (cl_real) view.juliaCY};
+		cl_float3 color = {view.color[0], view.color[1], view.color[2]};
+		queue.enqueueWriteBuffer(jobsBuffer, CL_FALSE, 0, jobs.size() * sizeof(cl_long4), jobs.data());
+		(*tileRenderFunc)(cl::EnqueueArgs(queue, cl::NDRange(TILE_SIZE, TILE_SIZE, count)), atlasBuffer, jobsBuffer, origin,
+		                  extent, view.iterations, juliaC);
+		(*tileColorizeFunc)(cl::EnqueueArgs(queue, cl::NDRange(cl::nextDivisible(texels, 256)), cl::NDRange(256)), atlasBuffer, rgbaBuffer,
+		                    color, texels);
+		rgba = (const unsigned char *) queue.enqueueMapBuffer(rgbaBuffer, CL_TRUE, CL_MAP_READ, 0, texels * 4);
+	}
+	catch (cl::Error error)
+	{
+		std::cerr << "[RenderWorker] rendering failed: " << error.what() << "(" << cl::errorString(error.err()) << ")" << std::endl;
+		return false;
+	}
+
+	// every tile is its own message, so the coordinator can use it as soon as it arrives
+	bool sent = true;
+	for (size_t i = 0; sent && i < count; ++i)
+	{
+		const cluster::MessageHeader header = {cluster::TILE, (uint32_t) (sizeof(cluster::TileIndex) + TILE_SIZE * TILE_SIZE * 4)};
+		sent = cluster::sendAll(socket, &header, sizeof(header)) && cluster::sendAll(socket, &tiles[i], sizeof(cluster::TileIndex)) &&
+		       cluster::sendAll(socket, rgba + i * TILE_SIZE * TILE_SIZE * 4, TILE_SIZE * TILE_SIZE * 4);
+	}
+	queue.enqueueUnmapMemObject(rgbaBuffer, (void *) rgba);
+	return sent;
+}
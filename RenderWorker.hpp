@@ -0,0 +1,66 @@
+#pragma once
+
+#include <string>
+#include <memory>
+#include "OCLRenderer.hpp"
+#include "ClusterProtocol.hpp"
+
+/**
+ * headless worker of a distributed render. It connects to a RenderCoordinator, renders the tiles of the view it is
+ * assigned and streams them back as RGBA8 images until the coordinator is done
+ */
+class RenderWorker
+{
+private:
+	// tiles rendered in one launch, assignments are split into batches of this size
+	static const size_t MAX_BATCH = 16;
+
+	std::string sourceFilename;
+	cluster::ViewMessage view;
+	// formula the program was built for
+	std::string formula;
+
+	cl::Context context;
+	cl::Device device;
+	cl::CommandQueue queue;
+	cl::Program program;
+	std::shared_ptr<cl::make_kernel<cl::Buffer &, cl::Buffer &, cl_real2, cl_real, cl_int, cl_real2>> tileRenderFunc;
+	std::shared_ptr<cl::make_kernel<cl::Buffer &, cl::Buffer &, cl_float3, cl_uint>> tileColorizeFunc;
+	cl::Buffer atlasBuffer;
+	cl::Buffer rgbaBuffer;
+	cl::Buffer jobsBuffer;
+	// the cosine palette baked with the color of the view
+	cl::Image1D paletteImage;
+
+	/**
+	 * compiles the tile kernels of the kernel template for the formula
+	 *
+	 * @return false if there is no such formula
+	 */
+	bool build(const std::string &formula);
+
+	/**
+	 * renders the tiles in one launch and sends them to the coordinator
+	 *
+	 * @return false if the connection was lost
+	 */
+	bool renderBatch(int socket, const cluster::TileIndex *tiles, size_t count);
+
+public:
+	/**
+	 * creates an OpenCL context without GL sharing
+	 *
+	 * @param deviceIndex see cl::headlessDevice
+	 * @param partition see cl::partitionDevice, the worker renders on the first sub-device and leaves the other
+	 * compute units free, empty for the whole device
+	 */
+	RenderWorker(int deviceIndex = -1, const std::string &partition = "", const std::string &sourceFilename = "kernels/default.cl");
+
+	/**
+	 * connects to the coordinator, retrying until it is listening, and renders until it is done
+	 *
+	 * @param address "unix:/path/to/socket" or "host:port"
+	 * @return false if the connection was lost before the coordinator was done
+	 */
+	bool run(const std::string &address);
+};
@@ -0,0 +1,16 @@
+#pragma once
+
+#include <vector>
+#include <algorithm>
+#include <cstddef>
+
+/**
+ * @return the value below which the fraction p of the values lie, 0 if there are none
+ */
+inline double percentile(std::vector<double> values, double p)
+{
+	if (values.empty())
+		return 0.0;
+	std::sort(values.begin(), values.end());
+	return values[std::min(values.size() - 1, (size_t) (p * values.size()))];
+}
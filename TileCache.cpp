@@ -0,0 +1,119 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <tuple>
+#include <cstdio>
+#include "TileCache.hpp"
+
+bool TileCache::Key::operator<(const Key &other) const
+{
+	return std::tie(level, x, y, iterations, fractal) < std::tie(other.level, other.x, other.y, other.iterations, other.fractal);
+}
+
+TileCache::TileCache(size_t memoryBudget, const std::string &spillDirectory, size_t diskBudget) : memoryBudget(memoryBudget), memoryUsed(0),
+                                                                                                  spillDirectory(spillDirectory), diskBudget(diskBudget),
+                                                                                                  diskUsed(0), spillCount(0), hits(0), misses(0)
+{
+}
+
+TileCache::~TileCache()
+{
+	while (!diskTiles.empty())
+		removeFromDisk(diskTiles.begin());
+}
+
+const std::vector<float> *TileCache::lookup(const Key &key)
+{
+	auto memory = memoryTiles.find(key);
+	if (memory != memoryTiles.end())
+	{
+		++hits;
+		memoryOrder.splice(memoryOrder.begin(), memoryOrder, memory->second.use);
+		return &memory->second.data;
+	}
+
+	auto disk = diskTiles.find(key);
+	if (disk != diskTiles.end())
+	{
+		std::ifstream file(disk->second.filename, std::ios::binary);
+		std::vector<float> data(disk->second.bytes / sizeof(float));
+		const bool read = (bool) file.read((char *) data.data(), disk->second.bytes);
+		file.close();
+		removeFromDisk(disk);
+		if (read)
+		{
+			++hits;
+			store(key, std::move(data));
+			return &memoryTiles[key].data;
+		}
+	}
+	++misses;
+	return nullptr;
+}
+
+void TileCache::store(const Key &key, std::vector<float> data)
+{
+	auto old = memoryTiles.find(key);
+	if (old != memoryTiles.end())
+	{
+		memoryUsed -= old->second.data.size() * sizeof(float);
+		memoryOrder.erase(old->second.use);
+		memoryTiles.erase(old);
+	}
+	memoryUsed += data.size() * sizeof(float);
+	memoryOrder.push_front(key);
+	memoryTiles[key] = {std::move(data), memoryOrder.begin()};
+
+	// the new tile is never evicted, even if it alone exceeds the budget
+	while (memoryUsed > memoryBudget && memoryOrder.size() > 1)
+	{
+		auto evicted = memoryTiles.find(memoryOrder.back());
+		if (!spillDirectory.empty() && diskBudget > 0)
+			spill(evicted->first, evicted->second.data);
+		memoryUsed -= evicted->second.data.size() * sizeof(float);
+		memoryOrder.pop_back();
+		memoryTiles.erase(evicted);
+	}
+}
+
+void TileCache::spill(const Key &key, const std::vector<float> &data)
+{
+	auto old = diskTiles.find(key);
+	if (old != diskTiles.end())
+		removeFromDisk(old);
+
+	std::ostringstream filename;
+	filename << spillDirectory << "/tile" << spillCount++ << ".raw";
+	std::ofstream file(filename.str(), std::ios::binary);
+	if (!file.write((const char *) data.data(), data.size() * sizeof(float)))
+	{
+		std::cerr << "[TileCache] couldn't write " << filename.str() << std::endl;
+		file.close();
+		std::remove(filename.str().c_str());
+		return;
+	}
+	diskOrder.push_front(key);
+	diskTiles[key] = {filename.str(), data.size() * sizeof(float), diskOrder.begin()};
+	diskUsed += data.size() * sizeof(float);
+
+	while (diskUsed > diskBudget && !diskOrder.empty())
+		removeFromDisk(diskTiles.find(diskOrder.back()));
+}
+
+void TileCache::removeFromDisk(std::map<Key, DiskTile>::iterator tile)
+{
+	std::remove(tile->second.filename.c_str());
+	diskUsed -= tile->second.bytes;
+	diskOrder.erase(tile->second.use);
+	diskTiles.erase(tile);
+}
+
+size_t TileCache::getHits() const
+{
+	return hits;
+}
+
+size_t TileCache::getMisses() const
+{
+	return misses;
+}
@@ -0,0 +1,98 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <list>
+#include <map>
+#include <cstddef>
+
+/**
+ * least recently used cache of rendered quadtree tiles in host memory, tiles evicted from memory can be
+ * spilled to files in a directory, which form a second, slower tier with its own budget
+ */
+class TileCache
+{
+public:
+	/**
+	 * address of a tile, the tile (x, y) of level covers [x, x + 1) * extent / 2^level in the complex plane
+	 */
+	struct Key
+	{
+		int level;
+		long long x;
+		long long y;
+		int iterations;
+		// formula and its parameters, tiles of different fractals never mix
+		std::string fractal;
+
+		bool operator<(const Key &other) const;
+	};
+
+private:
+	// most recently used first
+	typedef std::list<Key> Order;
+
+	struct MemoryTile
+	{
+		std::vector<float> data;
+		Order::iterator use;
+	};
+
+	struct DiskTile
+	{
+		std::string filename;
+		size_t bytes;
+		Order::iterator use;
+	};
+
+	size_t memoryBudget;
+	size_t memoryUsed;
+	Order memoryOrder;
+	std::map<Key, MemoryTile> memoryTiles;
+
+	std::string spillDirectory;
+	size_t diskBudget;
+	size_t diskUsed;
+	unsigned long long spillCount;
+	Order diskOrder;
+	std::map<Key, DiskTile> diskTiles;
+
+	size_t hits;
+	size_t misses;
+
+	/**
+	 * writes the tile to the disk tier, the least recently used files are removed until the disk budget is kept
+	 */
+	void spill(const Key &key, const std::vector<float> &data);
+
+	void removeFromDisk(std::map<Key, DiskTile>::iterator tile);
+
+public:
+	/**
+	 * @param memoryBudget bytes of tile data kept in memory
+	 * @param spillDirectory existing directory for evicted tiles, empty to drop them
+	 * @param diskBudget bytes of tile data kept in the spill directory
+	 */
+	TileCache(size_t memoryBudget, const std::string &spillDirectory = "", size_t diskBudget = 0);
+
+	/**
+	 * removes all spilled tiles
+	 */
+	~TileCache();
+
+	/**
+	 * looks the tile up in memory and then on disk, a tile found on disk is moved back to memory
+	 *
+	 * @return the tile data, which is valid until the next call of lookup or store, or nullptr on a miss
+	 */
+	const std::vector<float> *lookup(const Key &key);
+
+	/**
+	 * adds or replaces the tile, least recently used tiles are evicted until the memory budget is kept
+	 */
+	void store(const Key &key, std::vector<float> data);
+
+	size_t getHits() const;
+
+	size_t getMisses() const;
+};
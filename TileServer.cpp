@@ -0,0 +1,526 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <thread>
+#include <random>
+#include <algorithm>
+#include <tuple>
+#include <cstring>
+#include <cstdint>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include "TileServer.hpp"
+#include "CLUtils.hpp"
+#include "Statistics.hpp"
+
+// has to match TILE_SIZE in the kernel
+static const size_t TILE_SIZE = 256;
+// tile 0/0/0 covers ORIGIN + [0, ROOT_EXTENT)^2, centered on the main cardioid. XYZ tiles count the rows from the
+// top, the kernel from ORIGIN_Y up
+static const double ROOT_EXTENT = 4.0;
+static const double ORIGIN_X = -2.5;
+static const double ORIGIN_Y = -2.0;
+
+// connections served at once, further clients wait in the listen backlog
+static const size_t MAX_CONNECTIONS = 256;
+// a batch is launched when it is full or BATCH_WINDOW after its first request
+static const size_t MAX_BATCH = 32;
+static const std::chrono::milliseconds BATCH_WINDOW(2);
+static const std::chrono::seconds REPORT_INTERVAL(10);
+
+bool TileServer::Key::operator<(const Key &other) const
+{
+	return std::tie(z, x, y) < std::tie(other.z, other.x, other.y);
+}
+
+static uint32_t crc32(const unsigned char *data, size_t length, uint32_t crc = 0)
+{
+	static uint32_t table[256] = {0};
+	if (!table[1])
+		for (uint32_t n = 0; n < 256; ++n)
+		{
+			uint32_t c = n;
+			for (int k = 0; k < 8; ++k)
+				c = c & 1 ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+			table[n] = c;
+		}
+	crc = ~crc;
+	for (size_t i = 0; i < length; ++i)
+		crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+	return ~crc;
+}
+
+static void appendBigEndian(std::string &out, uint32_t value)
+{
+	for (int shift = 24; shift >= 0; shift -= 8)
+		out += (char) ((value >> shift) & 0xFF);
+}
+
+static void appendChunk(std::string &png, const char *type, const std::string &data)
+{
+	appendBigEndian(png, (uint32_t) data.size());
+	const std::string chunk = std::string(type, 4) + data;
+	png += chunk;
+	appendBigEndian(png, crc32((const unsigned char *) chunk.data(), chunk.size()));
+}
+
+/**
+ * encodes a RGBA8 image as PNG with uncompressed deflate blocks, which costs no CPU time and is small enough
+ * for localhost. The rows are flipped, so the imaginary axis points up
+ */
+static std::string encodePng(const unsigned char *rgba, size_t width, size_t height)
+{
+	std::string raw;
+	raw.reserve(height * (1 + 4 * width));
+	for (size_t y = height; y-- > 0;)
+	{
+		// filter type none
+		raw += '\0';
+		raw.append((const char *) rgba + y * 4 * width, 4 * width);
+	}
+
+	std::string zlib("\x78\x01", 2);
+	uint32_t a = 1, b = 0;
+	for (unsigned char c : raw)
+	{
+		a = (a + c) % 65521;
+		b = (b + a) % 65521;
+	}
+	for (size_t offset = 0; offset < raw.size(); offset += 65535)
+	{
+		const uint16_t length = (uint16_t) std::min((size_t) 65535, raw.size() - offset);
+		zlib += (char) (offset + length == raw.size() ? 1 : 0);
+		zlib += (char) (length & 0xFF);
+		zlib += (char) (length >> 8);
+		zlib += (char) (~length & 0xFF);
+		zlib += (char) ((uint16_t) ~length >> 8);
+		zlib.append(raw, offset, length);
+	}
+	appendBigEndian(zlib, (b << 16) | a);
+
+	std::string header;
+	appendBigEndian(header, (uint32_t) width);
+	appendBigEndian(header, (uint32_t) height);
+	// 8 bit RGBA, deflate, no interlacing
+	header += std::string("\x08\x06\x00\x00\x00", 5);
+
+	std::string png("\x89PNG\r\n\x1a\n", 8);
+	appendChunk(png, "IHDR", header);
+	appendChunk(png, "IDAT", zlib);
+	appendChunk(png, "IEND", "");
+	return png;
+}
+
+static bool sendAll(int socket, const std::string &data)
+{
+	for (size_t sent = 0; sent < data.size();)
+	{
+		const ssize_t n = send(socket, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+		if (n <= 0)
+			return false;
+		sent += n;
+	}
+	return true;
+}
+
+/**
+ * reads from the socket until buffer contains the delimiter, returns false if the connection was closed before
+ */
+static bool receiveUntil(int socket, std::string &buffer, const std::string &delimiter)
+{
+	char chunk[4096];
+	while (buffer.find(delimiter) == std::string::npos)
+	{
+		const ssize_t n = recv(socket, chunk, sizeof(chunk), 0);
+		if (n <= 0)
+			return false;
+		buffer.append(chunk, n);
+	}
+	return true;
+}
+
+TileServer::TileServer(unsigned short port, const std::string &formula, cl_int iterations, size_t cacheBudget,
+                       const std::string &sourceFilename) : port(port), iterations(iterations), formula(formula),
+                                                            color({0.0f, 0.6f, 1.0f}), juliaC({-0.53060, -0.50340}), openConnections(0),
+                                                            cacheBudget(cacheBudget), cacheUsed(0), renderedTiles(0), launches(0),
+                                                            cacheHits(0)
+{
+	const std::string options = OCLRenderer::templateOptions(formula);
+	if (options.empty())
+	{
+		std::cerr << "[TileServer] unknown formula " << formula << std::endl;
+		exit(EXIT_FAILURE);
+	}
+	try
+	{
+		std::vector<cl::Platform> platforms;
+		cl::Platform::get(&platforms);
+		std::vector<cl::Device> devices;
+		for (const auto &p : platforms)
+		{
+			std::vector<cl::Device> platformDevices;
+			p.getDevices(CL_DEVICE_TYPE_ALL, &platformDevices);
+			for (const auto &d : platformDevices)
+				devices.push_back(d);
+		}
+		if (devices.empty())
+		{
+			std::cerr << "[TileServer] no opencl devices available" << std::endl;
+			exit(EXIT_FAILURE);
+		}
+		// no window, so there is no GL context to share, any GPU will do
+		device = devices[0];
+		for (const auto &d : devices)
+			if (d.getInfo<CL_DEVICE_TYPE>() == CL_DEVICE_TYPE_GPU)
+			{
+				device = d;
+				break;
+			}
+		context = cl::Context(device);
+		queue = cl::CommandQueue(context, device);
+		paletteImage = Palette::createImage(context);
+		Palette().upload(queue, paletteImage, color);
+
+		std::ifstream sourcefile(sourceFilename);
+		const std::string source((std::istreambuf_iterator<char>(sourcefile)), std::istreambuf_iterator<char>());
+		program = cl::Program(context, cl::Program::Sources(1, std::make_pair(source.c_str(), source.length() + 1)));
+		try
+		{
+			program.build(std::vector<cl::Device>(1, device), options.c_str());
+		}
+		catch (cl::Error error)
+		{
+			if (error.err() == CL_BUILD_PROGRAM_FAILURE)
+				std::cout << "Build log:" << std::endl << program.getBuildInfo<CL_PROGRAM_BUILD_LOG>(device) << std::endl;
+			throw;
+		}
+		tileRenderFunc.reset(new cl::make_kernel<cl::Buffer &, cl::Buffer &, cl_real2, cl_real, cl_int, cl_real2>(
+				cl::Kernel(program, "tile_render")));
+		cl::Kernel colorizeKernel(program, "tile_colorize");
+		colorizeKernel.setArg(4, paletteImage);
+		tileColorizeFunc.reset(new cl::make_kernel<cl::Buffer &, cl::Buffer &, cl_float3, cl_uint>(colorizeKernel));
+
+		atlasBuffer = cl::Buffer(context, CL_MEM_READ_WRITE, MAX_BATCH * TILE_SIZE * TILE_SIZE * sizeof(cl_float));
+		// the tiles are encoded from the mapped buffer, CPU and integrated devices keep it in host memory
+		const bool unifiedMemory = device.getInfo<CL_DEVICE_HOST_UNIFIED_MEMORY>() == CL_TRUE;
+		rgbaBuffer = cl::Buffer(context, CL_MEM_WRITE_ONLY | (unifiedMemory ? CL_MEM_ALLOC_HOST_PTR : 0),
+		                        MAX_BATCH * TILE_SIZE * TILE_SIZE * sizeof(cl_uchar4));
+		jobsBuffer = cl::Buffer(context, CL_MEM_READ_ONLY, MAX_BATCH * sizeof(cl_long4));
+		std::cout << "[TileServer] rendering " << formula << " with " << iterations << " iterations on " << device.getInfo<CL_DEVICE_NAME>() << std::endl;
+	}
+	catch (cl::Error error)
+	{
+		std::cout << error.what() << "(" << cl::errorString(error.err()) << ")" << std::endl;
+		exit(EXIT_FAILURE);
+	}
+}
+
+void TileServer::run()
+{
+	const int listener = socket(AF_INET, SOCK_STREAM, 0);
+	const int yes = 1;
+	setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+	sockaddr_in address;
+	std::memset(&address, 0, sizeof(address));
+	address.sin_family = AF_INET;
+	address.sin_port = htons(port);
+	address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if (listener < 0 || bind(listener, (sockaddr *) &address, sizeof(address)) < 0 || listen(listener, 128) < 0)
+	{
+		std::cerr << "[TileServer] couldn't listen on port " << port << std::endl;
+		exit(EXIT_FAILURE);
+	}
+	std::cout << "[TileServer] serving http://127.0.0.1:" << port << "/{z}/{x}/{y}.png" << std::endl;
+
+	reportStart = std::chrono::steady_clock::now();
+	std::thread(&TileServer::renderLoop, this).detach();
+	for (;;)
+	{
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			connectionClosed.wait(lock, [this] { return openConnections < MAX_CONNECTIONS; });
+		}
+		const int connection = accept(listener, nullptr, nullptr);
+		if (connection < 0)
+			continue;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			++openConnections;
+		}
+		std::thread(&TileServer::serveConnection, this, connection).detach();
+	}
+}
+
+void TileServer::renderLoop()
+{
+	for (;;)
+	{
+		std::vector<std::shared_ptr<Pending>> batch;
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			if (!jobsQueued.wait_for(lock, REPORT_INTERVAL, [this] { return !jobs.empty(); }))
+			{
+				report();
+				continue;
+			}
+			// give the other requests of the same view a moment to join the batch
+			jobsQueued.wait_for(lock, BATCH_WINDOW, [this] { return jobs.size() >= MAX_BATCH; });
+			while (!jobs.empty() && batch.size() < MAX_BATCH)
+			{
+				batch.push_back(jobs.front());
+				jobs.pop_front();
+			}
+		}
+
+		renderBatch(batch);
+
+		std::lock_guard<std::mutex> lock(mutex);
+		for (const auto &pending : batch)
+		{
+			pending->done = true;
+			inFlight.erase(pending->key);
+			// failed tiles are answered with an error and rendered again on the next request
+			if (!pending->png)
+				continue;
+			// keep the tile, evicting the least recently used ones
+			cache[pending->key] = {pending->png, cacheOrder.insert(cacheOrder.begin(), pending->key)};
+			cacheUsed += pending->png->size();
+			while (cacheUsed > cacheBudget && cacheOrder.size() > 1)
+			{
+				auto evicted = cache.find(cacheOrder.back());
+				cacheUsed -= evicted->second.first->size();
+				cache.erase(evicted);
+				cacheOrder.pop_back();
+			}
+		}
+		renderedTiles += batch.size();
+		++launches;
+		tilesDone.notify_all();
+		if (std::chrono::steady_clock::now() - reportStart >= REPORT_INTERVAL)
+			report();
+	}
+}
+
+void TileServer::setJuliaC(double x, double y)
+{
+	juliaC = {x, y};
+}
+
+void TileServer::renderBatch(const std::vector<std::shared_ptr<Pending>> &batch)
+{
+	// tiles of all levels are rendered in one launch, every job carries its level and its slot in the atlas
+	std::vector<cl_long4> renderJobs;
+	for (size_t i = 0; i < batch.size(); ++i)
+	{
+		const Key &key = batch[i]->key;
+		renderJobs.push_back({(cl_long) key.x, (1ll << key.z) - 1 - (cl_long) key.y, key.z, (cl_long) i});
+	}
+	const cl_uint texels = batch.size() * TILE_SIZE * TILE_SIZE;
+	const unsigned char *rgba = nullptr;
+	try
+	{
+		cl_real2 origin = {(cl_real) ORIGIN_X, (cl_real) ORIGIN_Y};
+		cl_real2 c = {(cl_real) juliaC.s[0], (cl_real) juliaC.s[1]};
+		queue.enqueueWriteBuffer(jobsBuffer, CL_FALSE, 0, renderJobs.size() * sizeof(cl_long4), renderJobs.data());
+		(*tileRenderFunc)(cl::EnqueueArgs(queue, cl::NDRange(TILE_SIZE, TILE_SIZE, batch.size())), atlasBuffer, jobsBuffer, origin,
+		                  (cl_real) ROOT_EXTENT, iterations, c);
+		(*tileColorizeFunc)(cl::EnqueueArgs(queue, cl::NDRange(cl::nextDivisible(texels, 256)), cl::NDRange(256)), atlasBuffer, rgbaBuffer,
+		                    color, texels);
+		rgba = (const unsigned char *) queue.enqueueMapBuffer(rgbaBuffer, CL_TRUE, CL_MAP_READ, 0, texels * 4);
+	}
+	catch (cl::Error error)
+	{
+		std::cerr << "[TileServer] rendering failed: " << error.what() << "(" << cl::errorString(error.err()) << ")" << std::endl;
+	}
+	if (!rgba)
+		return;
+	for (size_t i = 0; i < batch.size(); ++i)
+		batch[i]->png = std::make_shared<const std::string>(encodePng(rgba + i * TILE_SIZE * TILE_SIZE * 4, TILE_SIZE, TILE_SIZE));
+	queue.enqueueUnmapMemObject(rgbaBuffer, (void *) rgba);
+}
+
+std::shared_ptr<const std::string> TileServer::tile(const Key &key)
+{
+	std::unique_lock<std::mutex> lock(mutex);
+	auto cached = cache.find(key);
+	if (cached != cache.end())
+	{
+		++cacheHits;
+		cacheOrder.splice(cacheOrder.begin(), cacheOrder, cached->second.second);
+		return cached->second.first;
+	}
+
+	// join the request that is already waiting for this tile, otherwise queue a new job
+	std::shared_ptr<Pending> pending;
+	auto running = inFlight.find(key);
+	if (running != inFlight.end())
+		pending = running->second;
+	else
+	{
+		pending.reset(new Pending{key, false, nullptr});
+		inFlight[key] = pending;
+		jobs.push_back(pending);
+		jobsQueued.notify_one();
+	}
+	tilesDone.wait(lock, [&pending] { return pending->done; });
+	return pending->png;
+}
+
+void TileServer::serveConnection(int socket)
+{
+	const int yes = 1;
+	setsockopt(socket, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
+	std::string buffer;
+	while (receiveUntil(socket, buffer, "\r\n\r\n"))
+	{
+		const size_t end = buffer.find("\r\n\r\n") + 4;
+		const std::string request = buffer.substr(0, end);
+		buffer.erase(0, end);
+		const auto start = std::chrono::steady_clock::now();
+
+		std::string method, path, version;
+		std::istringstream(request) >> method >> path >> version;
+		std::string lowerRequest = request;
+		std::transform(lowerRequest.begin(), lowerRequest.end(), lowerRequest.begin(), ::tolower);
+		const bool keepAlive = version == "HTTP/1.1" ? lowerRequest.find("connection: close") == std::string::npos
+		                                             : lowerRequest.find("connection: keep-alive") != std::string::npos;
+
+		Key key;
+		char suffix[8] = {0};
+		const bool valid = method == "GET" && sscanf(path.c_str(), "/%d/%lld/%lld.%4s", &key.z, &key.x, &key.y, suffix) == 4 &&
+		                   std::string(suffix) == "png" && key.z >= 0 && key.z < 62 && key.x >= 0 && key.y >= 0 &&
+		                   key.x < (1ll << key.z) && key.y < (1ll << key.z);
+		std::ostringstream header;
+		std::shared_ptr<const std::string> body;
+		if (valid && (body = tile(key)))
+			header << "HTTP/1.1 200 OK\r\nContent-Type: image/png\r\nCache-Control: max-age=86400\r\n";
+		else if (valid)
+		{
+			body = std::make_shared<const std::string>("rendering failed\n");
+			header << "HTTP/1.1 500 Internal Server Error\r\nContent-Type: text/plain\r\n";
+		}
+		else
+		{
+			body = std::make_shared<const std::string>("not found\n");
+			header << "HTTP/1.1 404 Not Found\r\nContent-Type: text/plain\r\n";
+		}
+		header << "Access-Control-Allow-Origin: *\r\nContent-Length: " << body->size() << "\r\nConnection: " <<
+		(keepAlive ? "keep-alive" : "close") << "\r\n\r\n";
+		if (!sendAll(socket, header.str()) || !sendAll(socket, *body))
+			break;
+
+		if (valid)
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			latencies.push_back(std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+		}
+		if (!keepAlive)
+			break;
+	}
+	close(socket);
+	std::lock_guard<std::mutex> lock(mutex);
+	--openConnections;
+	connectionClosed.notify_one();
+}
+
+void TileServer::report()
+{
+	const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - reportStart).count();
+	if (!latencies.empty())
+		std::cout << "[TileServer] " << latencies.size() / seconds << " tiles/s, " << renderedTiles << " rendered in " << launches <<
+		" launches, " << cacheHits << " from the cache, latency p50 " << percentile(latencies, 0.5) * 1000.0 << "ms p99 " <<
+		percentile(latencies, 0.99) * 1000.0 << "ms" << std::endl;
+	latencies.clear();
+	renderedTiles = launches = cacheHits = 0;
+	reportStart = std::chrono::steady_clock::now();
+}
+
+void TileServer::benchmark(unsigned short port, size_t connections, double seconds, int maxZoom)
+{
+	std::mutex latenciesMutex;
+	std::vector<double> latencies;
+	size_t failures = 0;
+	const auto deadline = std::chrono::steady_clock::now() + std::chrono::duration<double>(seconds);
+
+	std::vector<std::thread> clients;
+	for (size_t c = 0; c < connections; ++c)
+	{
+		clients.emplace_back([&, c]
+		{
+			// like a map viewer, every client looks at a neighbourhood of tiles on a random level
+			std::mt19937 random((unsigned int) c);
+			std::vector<double> ownLatencies;
+			size_t ownFailures = 0;
+			int socket = -1;
+			while (std::chrono::steady_clock::now() < deadline)
+			{
+				if (socket < 0)
+				{
+					socket = ::socket(AF_INET, SOCK_STREAM, 0);
+					sockaddr_in address;
+					std::memset(&address, 0, sizeof(address));
+					address.sin_family = AF_INET;
+					address.sin_port = htons(port);
+					address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+					const int yes = 1;
+					setsockopt(socket, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
+					if (connect(socket, (sockaddr *) &address, sizeof(address)) < 0)
+					{
+						std::cerr << "[TileServer] couldn't connect to port " << port << std::endl;
+						close(socket);
+						return;
+					}
+				}
+				const int z = std::uniform_int_distribution<int>(0, maxZoom)(random);
+				const long long size = 1ll << z;
+				const long long x = std::uniform_int_distribution<long long>(size / 4, std::max(size / 4, size * 3 / 4 - 1))(random);
+				const long long y = std::uniform_int_distribution<long long>(size / 4, std::max(size / 4, size * 3 / 4 - 1))(random);
+				std::ostringstream request;
+				request << "GET /" << z << "/" << x << "/" << y << ".png HTTP/1.1\r\nHost: 127.0.0.1\r\n\r\n";
+
+				const auto start = std::chrono::steady_clock::now();
+				std::string response;
+				bool ok = sendAll(socket, request.str()) && receiveUntil(socket, response, "\r\n\r\n");
+				if (ok)
+				{
+					const size_t headerEnd = response.find("\r\n\r\n") + 4;
+					std::string lowerHeader = response.substr(0, headerEnd);
+					std::transform(lowerHeader.begin(), lowerHeader.end(), lowerHeader.begin(), ::tolower);
+					const size_t lengthField = lowerHeader.find("content-length:");
+					const size_t length = lengthField == std::string::npos ? 0 : std::stoul(lowerHeader.substr(lengthField + 15));
+					char chunk[65536];
+					while (ok && response.size() < headerEnd + length)
+					{
+						const ssize_t n = recv(socket, chunk, std::min(sizeof(chunk), headerEnd + length - response.size()), 0);
+						ok = n > 0;
+						if (ok)
+							response.append(chunk, n);
+					}
+					ok = ok && response.compare(0, 12, "HTTP/1.1 200") == 0;
+				}
+				if (ok)
+					ownLatencies.push_back(std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+				else
+				{
+					++ownFailures;
+					close(socket);
+					socket = -1;
+				}
+			}
+			if (socket >= 0)
+				close(socket);
+			std::lock_guard<std::mutex> lock(latenciesMutex);
+			latencies.insert(latencies.end(), ownLatencies.begin(), ownLatencies.end());
+			failures += ownFailures;
+		});
+	}
+	for (auto &client : clients)
+		client.join();
+
+	std::cout << "[TileServer] benchmark: " << latencies.size() << " tiles in " << seconds << "s over " << connections << " connections, " <<
+	latencies.size() / seconds << " tiles/s, latency p50 " << percentile(latencies, 0.5) * 1000.0 << "ms p99 " <<
+	percentile(latencies, 0.99) * 1000.0 << "ms, " << failures << " failed" << std::endl;
+}
@@ -0,0 +1,127 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include "OCLRenderer.hpp"
+
+/**
+ * headless HTTP server for XYZ map tiles (GET /{z}/{x}/{y}.png) on localhost, for web map viewers.
+ * Concurrent requests are batched into one device launch, requests for a tile that is already being
+ * rendered wait for it and the encoded PNG tiles are kept in a least recently used cache
+ */
+class TileServer
+{
+private:
+	struct Key
+	{
+		int z;
+		long long x;
+		long long y;
+
+		bool operator<(const Key &other) const;
+	};
+
+	// a tile that is queued or being rendered, all requests for it wait for the same result
+	struct Pending
+	{
+		Key key;
+		bool done;
+		std::shared_ptr<const std::string> png;
+	};
+
+	unsigned short port;
+	cl_int iterations;
+	std::string formula;
+	cl_float3 color;
+	cl_double2 juliaC;
+
+	cl::Context context;
+	cl::Device device;
+	cl::CommandQueue queue;
+	// the cosine palette baked with the color
+	cl::Image1D paletteImage;
+	cl::Program program;
+	std::shared_ptr<cl::make_kernel<cl::Buffer &, cl::Buffer &, cl_real2, cl_real, cl_int, cl_real2>> tileRenderFunc;
+	std::shared_ptr<cl::make_kernel<cl::Buffer &, cl::Buffer &, cl_float3, cl_uint>> tileColorizeFunc;
+	cl::Buffer atlasBuffer;
+	cl::Buffer rgbaBuffer;
+	cl::Buffer jobsBuffer;
+
+	std::mutex mutex;
+	// signals new jobs to the render thread
+	std::condition_variable jobsQueued;
+	// signals finished tiles to the waiting requests
+	std::condition_variable tilesDone;
+	// connection threads, accepting waits while MAX_CONNECTIONS are open
+	size_t openConnections;
+	std::condition_variable connectionClosed;
+	std::list<std::shared_ptr<Pending>> jobs;
+	std::map<Key, std::shared_ptr<Pending>> inFlight;
+
+	// encoded tiles, most recently used first
+	size_t cacheBudget;
+	size_t cacheUsed;
+	std::list<Key> cacheOrder;
+	std::map<Key, std::pair<std::shared_ptr<const std::string>, std::list<Key>::iterator>> cache;
+
+	// statistics since the last report
+	std::chrono::steady_clock::time_point reportStart;
+	std::vector<double> latencies;
+	size_t renderedTiles;
+	size_t launches;
+	size_t cacheHits;
+
+	/**
+	 * renders the queued tiles in batches until the process ends, prints the statistics periodically
+	 */
+	void renderLoop();
+
+	/**
+	 * renders, colors and encodes the tiles in one launch, the PNGs of a failed launch stay null
+	 */
+	void renderBatch(const std::vector<std::shared_ptr<Pending>> &batch);
+
+	/**
+	 * answers the requests of one connection until the client closes it
+	 */
+	void serveConnection(int socket);
+
+	/**
+	 * @return the encoded tile, from the cache or rendered by the render thread, null if rendering failed
+	 */
+	std::shared_ptr<const std::string> tile(const Key &key);
+
+	void report();
+
+public:
+	/**
+	 * creates an OpenCL context without GL sharing on the first GPU, or on any device if there is none,
+	 * and compiles the tile kernels of the kernel template
+	 *
+	 * @param cacheBudget bytes of encoded tiles kept in memory
+	 */
+	TileServer(unsigned short port, const std::string &formula = "mandelbrot", cl_int iterations = 1000,
+	           size_t cacheBudget = 256 * 1024 * 1024, const std::string &sourceFilename = "kernels/default.cl");
+
+	/**
+	 * sets the constant c of the julia_set formula, has to be called before run
+	 */
+	void setJuliaC(double x, double y);
+
+	/**
+	 * listens on 127.0.0.1 and serves tiles until the process is terminated
+	 */
+	void run();
+
+	/**
+	 * local load generator, requests random tiles up to maxZoom from a running server over the given number of
+	 * connections and prints the throughput in tiles per second and the p50/p99 latency
+	 */
+	static void benchmark(unsigned short port, size_t connections, double seconds, int maxZoom);
+};
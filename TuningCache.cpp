@@ -0,0 +1,44 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include "TuningCache.hpp"
+
+// file format: one entry per line, "{key}\t{vectorWidth} {localSizeX} {localSizeY}"
+
+TuningCache::TuningCache(const std::string &filename) : filename(filename)
+{
+	std::ifstream file(filename);
+	std::string line;
+	while (std::getline(file, line))
+	{
+		size_t tab = line.rfind('\t');
+		if (tab == std::string::npos)
+			continue;
+		Entry entry;
+		std::istringstream values(line.substr(tab + 1));
+		if (values >> entry.vectorWidth >> entry.localSizeX >> entry.localSizeY)
+			entries[line.substr(0, tab)] = entry;
+	}
+}
+
+bool TuningCache::lookup(const std::string &key, Entry &entry) const
+{
+	auto it = entries.find(key);
+	if (it == entries.end())
+		return false;
+	entry = it->second;
+	return true;
+}
+
+void TuningCache::store(const std::string &key, const Entry &entry)
+{
+	entries[key] = entry;
+	std::ofstream file(filename);
+	if (!file)
+	{
+		std::cerr << "[TuningCache] couldn't write " << filename << std::endl;
+		return;
+	}
+	for (const auto &e : entries)
+		file << e.first << '\t' << e.second.vectorWidth << ' ' << e.second.localSizeX << ' ' << e.second.localSizeY << std::endl;
+}
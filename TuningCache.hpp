@@ -0,0 +1,40 @@
+#pragma once
+
+#include <string>
+#include <map>
+#include <cstddef>
+
+/**
+ * stores the fastest launch configuration of a kernel on a device in a small text file,
+ * so the autotuning only has to run on the first start
+ */
+class TuningCache
+{
+public:
+	struct Entry
+	{
+		unsigned int vectorWidth;
+		size_t localSizeX;
+		size_t localSizeY;
+	};
+
+private:
+	std::string filename;
+	std::map<std::string, Entry> entries;
+
+public:
+	/**
+	 * loads all entries of the given file, a missing file is treated as an empty cache
+	 */
+	TuningCache(const std::string &filename);
+
+	/**
+	 * @return true if there is an entry for the key, which is copied to entry
+	 */
+	bool lookup(const std::string &key, Entry &entry) const;
+
+	/**
+	 * adds or replaces the entry of the key and rewrites the file
+	 */
+	void store(const std::string &key, const Entry &entry);
+};
@@ -0,0 +1,176 @@
+#include <iostream>
+#include <algorithm>
+#include <cmath>
+#include "ViewControl.hpp"
+
+// bytes of tiles kept in memory when the tile cache is on
+static const size_t TILE_CACHE_BUDGET = 512 * 1024 * 1024;
+
+ViewControl::ViewControl(const RenderThread::View &view, const std::vector<Palette> &palettes)
+		: view(view), palettes(palettes), palette(0), zSpeed(1.25), width(view.width), height(view.height), posRelX(0),
+		  posRelY(0), posX(0), posY(0), oldPosY(0), oldPosX(0), leftPressed(false), rightPressed(false)
+{ }
+
+bool ViewControl::handle(const SDL_Event &event)
+{
+	bool needUpdate = false;
+	const cl_double2 pos = view.pos;
+	switch (event.type)
+	{
+		case SDL_WINDOWEVENT:
+			if (event.window.event == SDL_WINDOWEVENT_RESIZED)
+			{
+				width = event.window.data1;
+				height = event.window.data2;
+				view.width = event.window.data1;
+				view.height = event.window.data2;
+				needUpdate = true;
+			}
+
+			break;
+		case SDL_KEYDOWN:
+			if (event.key.keysym.sym == SDLK_c)
+			{
+				view.color = {(cl_float) (drand48() * M_PI * 2.0), (cl_float) (drand48() * M_PI * 2.0),
+				              (cl_float) (drand48() * M_PI * 2.0)};
+				needUpdate = true;
+			}
+			if (event.key.keysym.sym == SDLK_p)
+			{
+				++view.saveRequests;
+				needUpdate = true;
+			}
+			if (event.key.keysym.sym == SDLK_o)
+			{
+				static const char *toneCurveNames[] = {"linear", "gamma", "filmic"};
+				view.toneCurve = (ToneCurve) ((view.toneCurve + 1) % 3);
+				std::cout << "tone curve: " << toneCurveNames[view.toneCurve] << std::endl;
+			}
+			if (event.key.keysym.sym == SDLK_j)
+			{
+				++view.juliaGridRequests;
+				needUpdate = true;
+			}
+			if (event.key.keysym.sym == SDLK_e)
+			{
+				++view.exportRequests;
+				needUpdate = true;
+			}
+			if (event.key.keysym.sym == SDLK_PLUS)
+			{
+				view.iterations = (cl_int) (view.iterations * 1.25 + 1);
+				needUpdate = true;
+			}
+			if (event.key.keysym.sym == SDLK_MINUS)
+			{
+				view.iterations = std::max(1, (cl_int) (view.iterations * 0.8 - 1));
+				needUpdate = true;
+			}
+			if (event.key.keysym.sym == SDLK_g)
+			{
+				palette = (palette + 1) % palettes.size();
+				view.palette = palettes[palette];
+				std::cout << "palette: " << view.palette.getName() << std::endl;
+				needUpdate = true;
+			}
+			if (event.key.keysym.sym == SDLK_h)
+			{
+				view.colorMode = view.colorMode == SMOOTH ? HISTOGRAM : SMOOTH;
+				std::cout << "coloring: " << (view.colorMode == SMOOTH ? "smooth" : "histogram") << std::endl;
+				needUpdate = true;
+			}
+			if (event.key.keysym.sym == SDLK_t)
+			{
+				view.tileCacheBudget = view.tileCacheBudget ? 0 : TILE_CACHE_BUDGET;
+				std::cout << "tile cache: " << (view.tileCacheBudget ? "on" : "off") << std::endl;
+				needUpdate = true;
+			}
+			if (event.key.keysym.sym == SDLK_i)
+			{
+				view.importanceSampling = !view.importanceSampling;
+				std::cout << "importance sampling: " << (view.importanceSampling ? "on" : "off") << std::endl;
+				needUpdate = true;
+			}
+			if (event.key.keysym.sym == SDLK_w)
+			{
+				view.workCounters = !view.workCounters;
+				std::cout << "work counters: " << (view.workCounters ? "on" : "off") << std::endl;
+				needUpdate = true;
+			}
+			if (event.key.keysym.sym == SDLK_f)
+			{
+				// the render thread starts with the mandelbrot set
+				const std::vector<std::string> formulas = OCLRenderer::formulaNames();
+				const size_t formula = std::find(formulas.begin(), formulas.end(),
+				                                 view.formula.empty() ? "mandelbrot" : view.formula) - formulas.begin();
+				view.formula = formulas[(formula + 1) % formulas.size()];
+				std::cout << "formula: " << view.formula << std::endl;
+				needUpdate = true;
+			}
+			if (event.key.keysym.sym == SDLK_m)
+			{
+				static const char *modeNames[] = {"direct", "persistent threads", "wavefront", "orbit density"};
+				view.renderMode = (RenderMode) ((view.renderMode + 1) % 4);
+				std::cout << "render mode: " << modeNames[view.renderMode] << std::endl;
+				needUpdate = true;
+			}
+			break;
+		case SDL_MOUSEBUTTONDOWN:
+			if (event.button.button == SDL_BUTTON_LEFT && event.button.state == SDL_PRESSED)
+				leftPressed = true;
+			if (event.button.button == SDL_BUTTON_RIGHT && event.button.state == SDL_PRESSED)
+			{
+				rightPressed = true;
+				oldPosY = posY;
+				oldPosX = posX;
+			}
+			break;
+		case SDL_MOUSEBUTTONUP:
+			if (event.button.button == SDL_BUTTON_LEFT && event.button.state == SDL_RELEASED)
+				leftPressed = false;
+			if (event.button.button == SDL_BUTTON_RIGHT && event.button.state == SDL_RELEASED)
+				rightPressed = false;
+			break;
+		case SDL_MOUSEWHEEL:
+
+			if (event.wheel.y < 0)
+			{
+				view.pos = {pos.s[0] * 1.0 / zSpeed - (1.0 - 1.0 / zSpeed) * posX / width,
+				            pos.s[1] * 1.0 / zSpeed - (1.0 - 1.0 / zSpeed) * (height - posY) / width};
+				view.zoom *= zSpeed;
+			}
+			else if (event.wheel.y > 0)
+			{
+				view.pos = {pos.s[0] * zSpeed - (1.0 - zSpeed) * posX / width,
+				            pos.s[1] * zSpeed - (1.0 - zSpeed) * (height - posY) / width};
+				view.zoom /= zSpeed;
+			}
+			needUpdate = true;
+			break;
+		case SDL_MOUSEMOTION:
+			posRelX = event.motion.xrel;
+			posRelY = event.motion.yrel;
+			posX = event.motion.x;
+			posY = event.motion.y;
+			if (leftPressed)
+			{
+				view.pos = {-posRelX / width + pos.s[0], posRelY / width + pos.s[1]};
+				needUpdate = true;
+			}
+			if (rightPressed)
+			{
+				double zoomFact = 1.0f - posRelY * 0.02f;
+				view.pos = {pos.s[0] * zoomFact - (1.0 - zoomFact) * oldPosX / width,
+				            pos.s[1] * zoomFact - (1.0 - zoomFact) * (height - oldPosY) / width};
+				view.zoom /= zoomFact;
+				needUpdate = true;
+			}
+			break;
+	}
+	return needUpdate;
+}
+
+const RenderThread::View &ViewControl::getView() const
+{
+	return view;
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <SDL2/SDL.h>
+#include <vector>
+#include "RenderThread.hpp"
+#include "Palette.hpp"
+
+/**
+ * turns the input events of the window into changes of the view: dragging and zooming with the mouse and the
+ * keyboard controls. The event loop and the replay of recorded input traces drive the view through it the same way
+ */
+class ViewControl
+{
+private:
+	RenderThread::View view;
+	std::vector<Palette> palettes;
+	size_t palette;
+	double zSpeed;
+	double width;
+	double height;
+	double posRelX;
+	double posRelY;
+	double posX;
+	double posY;
+	double oldPosY;
+	double oldPosX;
+	bool leftPressed;
+	bool rightPressed;
+
+public:
+	/**
+	 * @param view the initial view, its size is the size of the window
+	 * @param palettes the palettes g cycles through, the first one is the palette of the view
+	 */
+	ViewControl(const RenderThread::View &view, const std::vector<Palette> &palettes);
+
+	/**
+	 * applies the event to the view, events that aren't input are ignored
+	 *
+	 * @return true if the view changed and has to be posted to the render thread
+	 */
+	bool handle(const SDL_Event &event);
+
+	const RenderThread::View &getView() const;
+};
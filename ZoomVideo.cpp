@@ -0,0 +1,336 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <chrono>
+#include <thread>
+#include <algorithm>
+#include <cmath>
+#include <SDL2/SDL.h>
+#include "ZoomVideo.hpp"
+#include "CLUtils.hpp"
+
+// frame pixels over which the finer keyframe fades in at its border
+static const double BLEND_MARGIN = 8.0;
+ZoomVideo::Settings::Settings() : width(1280), height(720), centerX(-0.743643887037151), centerY(0.131825904205330),
+                                  startExtent(4.0), doublings(12), framesPerDoubling(30), iterations(1000),
+                                  formula("mandelbrot"), juliaCX(-0.53060), juliaCY(-0.50340),
+                                  color({0.0f, 0.6f, 1.0f}), sampleGrid(4)
+{ }
+
+ZoomVideo::ZoomVideo(int deviceIndex, const std::string &partition, const std::string &sourceFilename) : sourceFilename(sourceFilename)
+{
+	try
+	{
+		cl::Device device = cl::headlessDevice(deviceIndex);
+		if (!device())
+		{
+			std::cerr << "[ZoomVideo] no such opencl device" << std::endl;
+			exit(EXIT_FAILURE);
+		}
+		std::vector<cl::Device> devices(1, device);
+		if (!partition.empty())
+		{
+			devices = cl::partitionDevice(device, partition);
+			if (devices.empty())
+			{
+				std::cerr << "[ZoomVideo] invalid partition " << partition << std::endl;
+				exit(EXIT_FAILURE);
+			}
+		}
+		context = cl::Context(devices);
+		for (const cl::Device &d : devices)
+			bands.push_back({d, cl::CommandQueue(context, d), d.getInfo<CL_DEVICE_MAX_COMPUTE_UNITS>()});
+		paletteImage = Palette::createImage(context);
+	}
+	catch (cl::Error error)
+	{
+		std::cout << error.what() << "(" << cl::errorString(error.err()) << ")" << std::endl;
+		exit(EXIT_FAILURE);
+	}
+}
+
+std::vector<cl_uchar> ZoomVideo::renderKeyframe(const Settings &settings, size_t level)
+{
+	const size_t width = 2 * settings.width;
+	const size_t height = 2 * settings.height;
+	const cl_double pixel = std::ldexp(settings.startExtent, -(int) level) / width;
+	const cl_double left = settings.centerX - 0.5 * width * pixel;
+	const cl_double bottom = settings.centerY - 0.5 * height * pixel;
+
+	// the keyframe is split into square viewports, which are all rendered in one launch per sample and band. The rows
+	// of viewports are split over the bands by their compute units
+	const size_t viewportsX = (width + VIEWPORT_SIZE - 1) / VIEWPORT_SIZE;
+	const size_t viewportsY = (height + VIEWPORT_SIZE - 1) / VIEWPORT_SIZE;
+	cl_uint computeUnits = 0;
+	for (const Band &band : bands)
+		computeUnits += band.computeUnits;
+	std::vector<size_t> firstRows(bands.size() + 1, 0);
+	cl_uint units = 0;
+	for (size_t b = 0; b < bands.size(); ++b)
+	{
+		units += bands[b].computeUnits;
+		firstRows[b + 1] = viewportsY * units / computeUnits;
+	}
+	std::vector<cl_uint> sums(width * height * 4, 0);
+	try
+	{
+		// created here and first written by the kernels of their band, so on a NUMA system they are placed in the
+		// memory of the node that renders them
+		std::vector<cl::Buffer> viewportsBuffers(bands.size());
+		std::vector<cl::Buffer> atlasBuffers(bands.size());
+		std::vector<cl::Buffer> rgbaBuffers(bands.size());
+		std::vector<std::vector<Viewport>> viewports(bands.size());
+		for (size_t b = 0; b < bands.size(); ++b)
+		{
+			const size_t count = (firstRows[b + 1] - firstRows[b]) * viewportsX;
+			if (!count)
+				continue;
+			const size_t texels = count * VIEWPORT_SIZE * VIEWPORT_SIZE;
+			viewportsBuffers[b] = cl::Buffer(context, CL_MEM_READ_ONLY, count * sizeof(Viewport));
+			atlasBuffers[b] = cl::Buffer(context, CL_MEM_READ_WRITE, texels * sizeof(cl_float));
+			rgbaBuffers[b] = cl::Buffer(context, CL_MEM_WRITE_ONLY | (bands[b].device.getInfo<CL_DEVICE_HOST_UNIFIED_MEMORY>() ? CL_MEM_ALLOC_HOST_PTR : 0),
+			                            texels * sizeof(cl_uchar4));
+			viewports[b].resize(count);
+		}
+		for (size_t sample = 0; sample < settings.sampleGrid * settings.sampleGrid; ++sample)
+		{
+			// offset of the sample from the pixel center
+			const cl_double dx = ((sample % settings.sampleGrid + 0.5) / settings.sampleGrid - 0.5) * pixel;
+			const cl_double dy = ((sample / settings.sampleGrid + 0.5) / settings.sampleGrid - 0.5) * pixel;
+			// all bands are started before the first one is read back
+			for (size_t b = 0; b < bands.size(); ++b)
+			{
+				const size_t count = viewports[b].size();
+				if (!count)
+					continue;
+				const cl_uint texels = count * VIEWPORT_SIZE * VIEWPORT_SIZE;
+				for (size_t i = 0; i < count; ++i)
+				{
+					const size_t v = firstRows[b] * viewportsX + i;
+					viewports[b][i] = {{(cl_real) (left + (v % viewportsX) * VIEWPORT_SIZE * pixel + dx),
+					                    (cl_real) (bottom + (v / viewportsX) * VIEWPORT_SIZE * pixel + dy)},
+					                   {(cl_real) settings.juliaCX, (cl_real) settings.juliaCY}, (cl_real) (VIEWPORT_SIZE * pixel), settings.iterations};
+				}
+				cl::CommandQueue &queue = bands[b].queue;
+				queue.enqueueWriteBuffer(viewportsBuffers[b], CL_FALSE, 0, count * sizeof(Viewport), viewports[b].data());
+				(*viewportsRenderFunc)(cl::EnqueueArgs(queue, cl::NDRange(VIEWPORT_SIZE, VIEWPORT_SIZE, count)), atlasBuffers[b],
+				                       viewportsBuffers[b], (cl_int) VIEWPORT_SIZE);
+				(*tileColorizeFunc)(cl::EnqueueArgs(queue, cl::NDRange(cl::nextDivisible(texels, 256)), cl::NDRange(256)), atlasBuffers[b],
+				                    rgbaBuffers[b], settings.color, texels);
+				queue.flush();
+			}
+			for (size_t b = 0; b < bands.size(); ++b)
+			{
+				const size_t count = viewports[b].size();
+				if (!count)
+					continue;
+				cl::CommandQueue &queue = bands[b].queue;
+				const cl_uchar *rgba = (const cl_uchar *) queue.enqueueMapBuffer(rgbaBuffers[b], CL_TRUE, CL_MAP_READ, 0,
+				                                                                 count * VIEWPORT_SIZE * VIEWPORT_SIZE * sizeof(cl_uchar4));
+				for (size_t i = 0; i < count; ++i)
+					for (size_t row = 0; row < VIEWPORT_SIZE; ++row)
+					{
+						const size_t v = firstRows[b] * viewportsX + i;
+						const size_t y = (v / viewportsX) * VIEWPORT_SIZE + row;
+						const size_t x0 = (v % viewportsX) * VIEWPORT_SIZE;
+						if (y >= height)
+							break;
+						const cl_uchar *source = rgba + (i * VIEWPORT_SIZE + row) * VIEWPORT_SIZE * 4;
+						cl_uint *target = &sums[(y * width + x0) * 4];
+						for (size_t c = 0; c < std::min(VIEWPORT_SIZE, width - x0) * 4; ++c)
+							target[c] += source[c];
+					}
+				queue.enqueueUnmapMemObject(rgbaBuffers[b], (void *) rgba);
+			}
+		}
+	}
+	catch (cl::Error error)
+	{
+		std::cerr << "[ZoomVideo] rendering keyframe " << level << " failed: " << error.what() << "(" << cl::errorString(error.err()) << ")" << std::endl;
+		exit(EXIT_FAILURE);
+	}
+
+	std::vector<cl_uchar> keyframe(sums.size());
+	const cl_uint samples = (cl_uint) (settings.sampleGrid * settings.sampleGrid);
+	for (size_t i = 0; i < sums.size(); ++i)
+		keyframe[i] = (cl_uchar) ((sums[i] + samples / 2) / samples);
+	return keyframe;
+}
+
+/**
+ * bilinear sample of the keyframe at the texel coordinates (u, v), clamped to its border, added to color
+ */
+static void addBilinear(const std::vector<cl_uchar> &keyframe, size_t width, size_t height, double u, double v, float color[4])
+{
+	u = std::min(std::max(u, 0.0), width - 1.0);
+	v = std::min(std::max(v, 0.0), height - 1.0);
+	const size_t x0 = std::min((size_t) u, width - 2);
+	const size_t y0 = std::min((size_t) v, height - 2);
+	const float fx = (float) (u - x0);
+	const float fy = (float) (v - y0);
+	const cl_uchar *p = &keyframe[(y0 * width + x0) * 4];
+	const cl_uchar *q = p + width * 4;
+	for (int c = 0; c < 4; ++c)
+		color[c] += (1.0f - fy) * ((1.0f - fx) * p[c] + fx * p[c + 4]) + fy * ((1.0f - fx) * q[c] + fx * q[c + 4]);
+}
+
+/**
+ * box filter of the keyframe over scale x scale texels around (u, v), approximated by four bilinear samples
+ */
+static void sampleKeyframe(const std::vector<cl_uchar> &keyframe, size_t width, size_t height, double u, double v, double scale,
+                           float color[4])
+{
+	const double d = 0.25 * scale;
+	std::fill(color, color + 4, 0.0f);
+	addBilinear(keyframe, width, height, u - d, v - d, color);
+	addBilinear(keyframe, width, height, u + d, v - d, color);
+	addBilinear(keyframe, width, height, u - d, v + d, color);
+	addBilinear(keyframe, width, height, u + d, v + d, color);
+	for (int c = 0; c < 4; ++c)
+		color[c] *= 0.25f;
+}
+
+void ZoomVideo::synthesizeFrame(const Settings &settings, const std::vector<cl_uchar> &keyframe,
+                                const std::vector<cl_uchar> *next, double t, std::vector<cl_uchar> &frame)
+{
+	const size_t width = settings.width;
+	const size_t height = settings.height;
+	// keyframe texels per frame pixel, the next keyframe has twice as many
+	const double scale = 2.0 * std::exp2(-t);
+	auto rows = [&](size_t first, size_t last)
+	{
+		float color[4];
+		float finer[4];
+		for (size_t y = first; y < last; ++y)
+			for (size_t x = 0; x < width; ++x)
+			{
+				// offset from the center in frame pixels, the frame rows go down
+				const double fx = x + 0.5 - 0.5 * width;
+				const double fy = 0.5 * height - y - 0.5;
+				sampleKeyframe(keyframe, 2 * width, 2 * height, fx * scale + width - 0.5, fy * scale + height - 0.5, scale, color);
+				if (next)
+				{
+					// the finer keyframe covers the center, it fades in over BLEND_MARGIN pixels at its border
+					const double border = std::min(width / (2.0 * scale) - std::abs(fx), height / (2.0 * scale) - std::abs(fy));
+					const float weight = (float) std::min(std::max(border / BLEND_MARGIN, 0.0), 1.0);
+					if (weight > 0.0f)
+					{
+						sampleKeyframe(*next, 2 * width, 2 * height, fx * 2.0 * scale + width - 0.5, fy * 2.0 * scale + height - 0.5, 2.0 * scale,
+						               finer);
+						for (int c = 0; c < 4; ++c)
+							color[c] += weight * (finer[c] - color[c]);
+					}
+				}
+				for (int c = 0; c < 4; ++c)
+					frame[(y * width + x) * 4 + c] = (cl_uchar) (color[c] + 0.5f);
+			}
+	};
+
+	// the rows are split over all cores
+	const size_t threadCount = std::max(1u, std::thread::hardware_concurrency());
+	std::vector<std::thread> threads;
+	for (size_t i = 0; i < threadCount; ++i)
+		threads.push_back(std::thread(rows, height * i / threadCount, height * (i + 1) / threadCount));
+	for (auto &thread : threads)
+		thread.join();
+}
+
+bool ZoomVideo::render(const Settings &settings, const std::string &prefix)
+{
+	const std::string options = OCLRenderer::templateOptions(settings.formula);
+	if (options.empty())
+	{
+		std::cerr << "[ZoomVideo] unknown formula " << settings.formula << std::endl;
+		return false;
+	}
+	try
+	{
+		std::ifstream sourcefile(sourceFilename);
+		const std::string source((std::istreambuf_iterator<char>(sourcefile)), std::istreambuf_iterator<char>());
+		program = cl::Program(context, cl::Program::Sources(1, std::make_pair(source.c_str(), source.length() + 1)));
+		Palette().upload(bands[0].queue, paletteImage, settings.color);
+		std::vector<cl::Device> devices;
+		for (const Band &band : bands)
+			devices.push_back(band.device);
+		try
+		{
+			program.build(devices, options.c_str());
+		}
+		catch (cl::Error error)
+		{
+			if (error.err() == CL_BUILD_PROGRAM_FAILURE)
+				std::cout << "Build log:" << std::endl << program.getBuildInfo<CL_PROGRAM_BUILD_LOG>(devices[0]) << std::endl;
+			throw;
+		}
+		viewportsRenderFunc.reset(new cl::make_kernel<cl::Buffer &, cl::Buffer &, cl_int>(cl::Kernel(program, "viewports_render")));
+		cl::Kernel colorizeKernel(program, "tile_colorize");
+		colorizeKernel.setArg(4, paletteImage);
+		tileColorizeFunc.reset(new cl::make_kernel<cl::Buffer &, cl::Buffer &, cl_float3, cl_uint>(colorizeKernel));
+	}
+	catch (cl::Error error)
+	{
+		std::cout << error.what() << "(" << cl::errorString(error.err()) << ")" << std::endl;
+		exit(EXIT_FAILURE);
+	}
+
+	const size_t frameCount = settings.doublings * settings.framesPerDoubling + 1;
+	std::cout << "[ZoomVideo] " << frameCount << " frames of " << settings.width << "x" << settings.height << " from " <<
+	settings.doublings + 1 << " keyframes on " << bands[0].device.getInfo<CL_DEVICE_NAME>();
+	if (bands.size() > 1)
+		std::cout << " in " << bands.size() << " bands";
+	std::cout << std::endl;
+
+	double keyframeSeconds = 0.0;
+	double synthesisSeconds = 0.0;
+	auto timed = [](double &seconds, std::chrono::steady_clock::time_point start)
+	{
+		seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	};
+	auto start = std::chrono::steady_clock::now();
+	std::vector<cl_uchar> keyframe = renderKeyframe(settings, 0);
+	timed(keyframeSeconds, start);
+	std::vector<cl_uchar> next;
+	std::vector<cl_uchar> frame(settings.width * settings.height * 4);
+	for (size_t level = 0; level <= settings.doublings; ++level)
+	{
+		const bool last = level == settings.doublings;
+		if (!last)
+		{
+			start = std::chrono::steady_clock::now();
+			next = renderKeyframe(settings, level + 1);
+			timed(keyframeSeconds, start);
+		}
+		for (size_t i = 0; i < (last ? 1 : settings.framesPerDoubling); ++i)
+		{
+			start = std::chrono::steady_clock::now();
+			synthesizeFrame(settings, keyframe, last ? nullptr : &next, (double) i / settings.framesPerDoubling, frame);
+			timed(synthesisSeconds, start);
+
+#if SDL_BYTEORDER == SDL_BIG_ENDIAN
+			SDL_Surface *image = SDL_CreateRGBSurfaceFrom(frame.data(), settings.width, settings.height, 32, 4 * settings.width,
+			                                              0xFF000000, 0x00FF0000, 0x0000FF00, 0x000000FF);
+#else
+			SDL_Surface *image = SDL_CreateRGBSurfaceFrom(frame.data(), settings.width, settings.height, 32, 4 * settings.width,
+			                                              0x000000FF, 0x0000FF00, 0x00FF0000, 0xFF000000);
+#endif
+			std::ostringstream filename;
+			filename << prefix << "_" << std::setw(5) << std::setfill('0') << level * settings.framesPerDoubling + i << ".bmp";
+			const bool saved = image && SDL_SaveBMP(image, filename.str().c_str()) == 0;
+			SDL_FreeSurface(image);
+			if (!saved)
+			{
+				std::cerr << "[ZoomVideo] couldn't save " << filename.str() << ": " << SDL_GetError() << std::endl;
+				return false;
+			}
+		}
+		keyframe.swap(next);
+		std::cout << "[ZoomVideo] level " << level << " done" << std::endl;
+	}
+
+	// a frame rendered at the same quality costs as much as a keyframe
+	const double everyFrame = keyframeSeconds / (settings.doublings + 1) * frameCount;
+	std::cout << "[ZoomVideo] keyframes " << keyframeSeconds << "s, blending " << synthesisSeconds << "s, rendering every frame would take about " <<
+	everyFrame << "s (" << everyFrame / (keyframeSeconds + synthesisSeconds) << "x)" << std::endl;
+	return true;
+}
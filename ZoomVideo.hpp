@@ -0,0 +1,95 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <memory>
+#include "OCLRenderer.hpp"
+
+/**
+ * headless renderer of exponential zoom videos. Only one keyframe per halving of the extent is rendered, at twice
+ * the output resolution and with several samples per pixel, every frame in between is a blend of the two keyframes
+ * around it scaled to its extent
+ */
+class ZoomVideo
+{
+public:
+	struct Settings
+	{
+		size_t width;
+		size_t height;
+		// point the video zooms into, it stays in the center of the frames
+		cl_double centerX;
+		cl_double centerY;
+		// real extent of the first frame
+		cl_double startExtent;
+		// halvings of the extent from the first to the last frame
+		size_t doublings;
+		size_t framesPerDoubling;
+		cl_int iterations;
+		std::string formula;
+		// parameter of the Julia formulas
+		cl_double juliaCX;
+		cl_double juliaCY;
+		cl_float3 color;
+		// samples per keyframe pixel on a regular grid, per axis
+		size_t sampleGrid;
+
+		Settings();
+	};
+
+private:
+	// edge length of the viewports a keyframe is split into
+	static const size_t VIEWPORT_SIZE = 256;
+
+	// the keyframes are split into horizontal bands, one per (sub-)device
+	struct Band
+	{
+		cl::Device device;
+		cl::CommandQueue queue;
+		// share of the keyframe rows
+		cl_uint computeUnits;
+	};
+
+	std::string sourceFilename;
+	cl::Context context;
+	std::vector<Band> bands;
+	// the cosine palette baked with the color of the settings
+	cl::Image1D paletteImage;
+	cl::Program program;
+	std::shared_ptr<cl::make_kernel<cl::Buffer &, cl::Buffer &, cl_int>> viewportsRenderFunc;
+	std::shared_ptr<cl::make_kernel<cl::Buffer &, cl::Buffer &, cl_float3, cl_uint>> tileColorizeFunc;
+
+	/**
+	 * renders the keyframe of the extent startExtent / 2^level
+	 *
+	 * @return 2 * width x 2 * height RGBA8 pixels, rows from the bottom up
+	 */
+	std::vector<cl_uchar> renderKeyframe(const Settings &settings, size_t level);
+
+	/**
+	 * blends the keyframe of the level and the next one, which is null after the last keyframe, into the frame
+	 * whose extent is t halvings below the one of the level
+	 *
+	 * @param frame width x height RGBA8 pixels, rows from the top down
+	 */
+	static void synthesizeFrame(const Settings &settings, const std::vector<cl_uchar> &keyframe,
+	                            const std::vector<cl_uchar> *next, double t, std::vector<cl_uchar> &frame);
+
+public:
+	/**
+	 * creates an OpenCL context without GL sharing
+	 *
+	 * @param deviceIndex see cl::headlessDevice
+	 * @param partition see cl::partitionDevice, the keyframes are rendered in bands on all sub-devices, empty for the
+	 * whole device
+	 */
+	ZoomVideo(int deviceIndex = -1, const std::string &partition = "", const std::string &sourceFilename = "kernels/default.cl");
+
+	/**
+	 * renders the video as numbered BMP frames {prefix}_{FRAME}.bmp and prints how long rendering every frame
+	 * would have taken instead
+	 *
+	 * @return false if the formula is unknown or a frame couldn't be saved
+	 */
+	bool render(const Settings &settings, const std::string &prefix);
+};
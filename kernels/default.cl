@@ -1,3 +1,174 @@
+//------------------------------------------------------------------------------
+// Kernel template
+// the host specializes this file with build options, every combination is
+// compiled to its own kernel without any runtime branching:
+//   USE_DOUBLE        double instead of single precision
+//   FORMULA           one of the FORMULA_* values below
+//   BAILOUT_UNROLL    check the bailout only every n iterations (default 1)
+//   VEC_WIDTH         compute a strip of VEC_WIDTH pixels per work-item
+//   HISTOGRAM_COLORING  store the smooth iteration count and color it with
+//                       the histogram_* kernels instead of coloring directly
+//   WORK_COUNTERS     the render kernels count their work, see Work counters
+//   PALETTE_TABLE     color through a lookup table instead of the cosine
+//                     palette, see Sampling and coloring
+//------------------------------------------------------------------------------
+
+#define FORMULA_MANDELBROT 0
+#define FORMULA_MANDELBROT_CUBIC 1
+#define FORMULA_BURNING_SHIP 2
+#define FORMULA_TRICORN 3
+#define FORMULA_JULIA 4
+
+#ifndef FORMULA
+#define FORMULA FORMULA_MANDELBROT
+#endif
+
+#ifndef BAILOUT_UNROLL
+#define BAILOUT_UNROLL 1
+#endif
+
+#define CAT_(a, b) a ## b
+#define CAT(a, b) CAT_(a, b)
+
+#ifdef USE_DOUBLE
+#pragma OPENCL EXTENSION cl_khr_fp64 : enable
+typedef double real;
+typedef double2 real2;
+typedef long mask;
+#define R(x) x
+#define realN CAT(double, VEC_WIDTH)
+#define maskN CAT(long, VEC_WIDTH)
+#define convert_real2 convert_double2
+#else
+typedef float real;
+typedef float2 real2;
+typedef int mask;
+#define R(x) CAT(x, f)
+#define realN CAT(float, VEC_WIDTH)
+#define maskN CAT(int, VEC_WIDTH)
+#define convert_real2 convert_float2
+#endif
+
+#define vloadN CAT(vload, VEC_WIDTH)
+#define vstoreN CAT(vstore, VEC_WIDTH)
+
+#define MAX_ABSOLUTE R(200.0)
+
+//------------------------------------------------------------------------------
+// Work counters
+// the render kernels take the counters as an additional last argument. Every
+// work-group counts in local memory and adds its totals to the global counters
+// once at the end: the iterations of all pixels (64 bit, low word first), the
+// finished pixels that escaped and the ones that reached the iteration limit,
+// and the lowest and highest escape iteration
+//------------------------------------------------------------------------------
+
+#define COUNTER_ITERATIONS 0
+#define COUNTER_ITERATIONS_HIGH 1
+#define COUNTER_ESCAPED 2
+#define COUNTER_INTERIOR 3
+#define COUNTER_MIN_ESCAPE 4
+#define COUNTER_MAX_ESCAPE 5
+#define COUNTERS 6
+
+#ifdef WORK_COUNTERS
+
+#define COUNTERS_PARAM , global uint* counters
+#define COUNTERS_BEGIN local uint groupCounters[COUNTERS]; beginCounters(groupCounters)
+#define COUNT_ITERATIONS(n) countIterations(groupCounters, n)
+#define COUNT_PIXEL(i, iterations) countPixel(groupCounters, i, iterations)
+#define COUNTERS_END endCounters(groupCounters, counters)
+
+inline bool firstInGroup()
+{
+	return get_local_id(0) == 0 && get_local_id(1) == 0;
+}
+
+inline void beginCounters(local uint* group)
+{
+	if (firstInGroup())
+	{
+		for (int c = 0; c < COUNTERS; ++c)
+			group[c] = 0;
+		group[COUNTER_MIN_ESCAPE] = UINT_MAX;
+	}
+	barrier(CLK_LOCAL_MEM_FENCE);
+}
+
+inline void countIterations(local uint* group, const uint n)
+{
+	// carry into the high word when the low word wraps
+	if (atomic_add(&group[COUNTER_ITERATIONS], n) + n < n)
+		atomic_inc(&group[COUNTER_ITERATIONS_HIGH]);
+}
+
+inline void countPixel(local uint* group, const int i, const int iterations)
+{
+	if (i >= iterations)
+		atomic_inc(&group[COUNTER_INTERIOR]);
+	else
+	{
+		atomic_inc(&group[COUNTER_ESCAPED]);
+		atomic_min(&group[COUNTER_MIN_ESCAPE], (uint)i);
+		atomic_max(&group[COUNTER_MAX_ESCAPE], (uint)i);
+	}
+}
+
+inline void endCounters(local uint* group, global uint* counters)
+{
+	barrier(CLK_LOCAL_MEM_FENCE);
+	if (firstInGroup())
+	{
+		const uint low = group[COUNTER_ITERATIONS];
+		const uint carry = atomic_add(&counters[COUNTER_ITERATIONS], low) + low < low ? 1 : 0;
+		atomic_add(&counters[COUNTER_ITERATIONS_HIGH], group[COUNTER_ITERATIONS_HIGH] + carry);
+		atomic_add(&counters[COUNTER_ESCAPED], group[COUNTER_ESCAPED]);
+		atomic_add(&counters[COUNTER_INTERIOR], group[COUNTER_INTERIOR]);
+		atomic_min(&counters[COUNTER_MIN_ESCAPE], group[COUNTER_MIN_ESCAPE]);
+		atomic_max(&counters[COUNTER_MAX_ESCAPE], group[COUNTER_MAX_ESCAPE]);
+	}
+}
+
+#else
+
+#define COUNTERS_PARAM
+#define COUNTERS_BEGIN
+#define COUNT_ITERATIONS(n)
+#define COUNT_PIXEL(i, iterations)
+#define COUNTERS_END
+
+#endif
+
+//------------------------------------------------------------------------------
+// Formulas
+// one iteration z -> f(z, c) for scalar and vector types,
+// xx and yy hold the squares of zx and zy before and after the step
+//------------------------------------------------------------------------------
+
+#if FORMULA == FORMULA_MANDELBROT || FORMULA == FORMULA_JULIA
+// z^2 + c
+#define FORMULA_DEGREE 2
+#define STEP(zx, zy, xx, yy, cx, cy) \
+	{ zy = (zx + zx) * zy + cy; zx = xx - yy + cx; xx = zx * zx; yy = zy * zy; }
+#elif FORMULA == FORMULA_MANDELBROT_CUBIC
+// z^3 + c
+#define FORMULA_DEGREE 3
+#define STEP(zx, zy, xx, yy, cx, cy) \
+	{ zx = zx * (xx - R(3.0) * yy) + cx; zy = zy * (R(3.0) * xx - yy) + cy; xx = zx * zx; yy = zy * zy; }
+#elif FORMULA == FORMULA_BURNING_SHIP
+// (|Re(z)| + i|Im(z)|)^2 + c
+#define FORMULA_DEGREE 2
+#define STEP(zx, zy, xx, yy, cx, cy) \
+	{ zy = fabs((zx + zx) * zy) + cy; zx = xx - yy + cx; xx = zx * zx; yy = zy * zy; }
+#elif FORMULA == FORMULA_TRICORN
+// conj(z)^2 + c
+#define FORMULA_DEGREE 2
+#define STEP(zx, zy, xx, yy, cx, cy) \
+	{ zy = cy - (zx + zx) * zy; zx = xx - yy + cx; xx = zx * zx; yy = zy * zy; }
+#else
+#error "unknown FORMULA"
+#endif
+
 //------------------------------------------------------------------------------
 // Random number generator
 // combined Tausworthe and LCG generator
@@ -24,68 +195,292 @@ inline float rand(uint4* z)
 	);
 }
 
-inline float2 complexMul(float2 a, float2 b)
+//------------------------------------------------------------------------------
+// Sampling and coloring
+// with PALETTE_TABLE the kernels that color take the palette as an additional
+// argument before the work counters, a table covering PALETTE_PERIOD of the
+// palette coordinate which repeats and is read with linear filtering
+//------------------------------------------------------------------------------
+
+#ifdef PALETTE_TABLE
+#define PALETTE_PERIOD 1.0f
+#define PALETTE_PARAM , read_only image1d_t paletteTable
+#define PALETTE_ARG , paletteTable
+const sampler_t paletteSampler = CLK_NORMALIZED_COORDS_TRUE | CLK_ADDRESS_REPEAT | CLK_FILTER_LINEAR;
+#else
+#define PALETTE_PARAM
+#define PALETTE_ARG
+#endif
+
+// tent filtered random position inside the pixel (x, y) in the complex plane
+inline real2 samplePoint(uint4* r, const int x, const int y, const int width, const real zoom, const real2 pos)
 {
-	return (float2)(a.x * b.x - a.y * b.y, a.x * b.y + a.y * b.x);
+	const real r1 = R(2.0)*rand(r), dx = r1<R(1.0) ? sqrt(r1)-R(1.0): R(1.0)-sqrt(R(2.0)-r1);
+	const real r2 = R(2.0)*rand(r), dy = r2<R(1.0) ? sqrt(r2)-R(1.0): R(1.0)-sqrt(R(2.0)-r2);
+	return (real2)(zoom * ((x + R(0.5) + dx/R(2.0)) / width + pos.x),
+	               zoom * ((y + R(0.5) + dy/R(2.0)) / width + pos.y));
 }
 
-inline float4 getColor(float3 col, int i, float absVal)
+// fractional escape iteration, continuous across the iteration bands
+inline float smoothIteration(int i, float absVal)
 {
+	return (float)i + 1.0f - log2(.5f * log2(absVal)) / log2((float)FORMULA_DEGREE);
+}
+
+// cosine palette, one period for co in [0, 1], or the palette table, which leaves out the sine term
+// whose phase grows with co^2. The smooth count and its square root are still computed per sample
+inline float4 palette(float3 col, float co PALETTE_PARAM)
+{
+#ifdef PALETTE_TABLE
+	return read_imagef(paletteTable, paletteSampler, co / PALETTE_PERIOD);
+#else
 	// The color scheme here is based on one
 	// from Inigo Quilez's Shader Toy:
-	float co = (float)i + 1.0f - log2(.5f * log2(absVal));
-	co = sqrt(co / 256.0f);
 	return (float4)(.5f + .5f * (cos(6.2831f * co + col.x) )+ 0.2f*sin(0.1f*6.2831f * co*co*25.0f + col.x),
 	                .5f + .5f * (cos(6.2831f * co + col.y) )+ 0.2f*sin(0.1f*6.2831f * co*co*25.0f + col.y),
 	                .5f + .5f * (cos(6.2831f * co + col.z) )+ 0.2f*sin(0.1f*6.2831f * co*co*25.0f + col.z),
 	                1.0f);
+#endif
+}
+
+inline float4 getColor(float3 col, int i, float absVal PALETTE_PARAM)
+{
+	return palette(col, sqrt(smoothIteration(i, absVal) / 256.0f) PALETTE_ARG);
+}
+
+// color of a stored smooth iteration count, negative inside the set
+inline float4 smoothColor(float3 col, float smooth PALETTE_PARAM)
+{
+	return smooth < 0.0f ? (float4)(0.0f, 0.0f, 0.0f, 1.0f) : palette(col, sqrt(smooth / 256.0f) PALETTE_ARG);
+}
+
+// adds the color to the accumulated pixel and writes the average to the image
+inline void accumulateColor(__read_write image2d_t image, global float4* imageRaw, const int x, const int y, const int width,
+                            const int sampleCount, const float4 color)
+{
+	const uint imgIndex = y*width + x;
+	const float4 val = (sampleCount - 1 ? imageRaw[imgIndex] : (float4)(0.0f, 0.0f, 0.0f, 0.0f)) + color;
+	imageRaw[imgIndex] = val;
+
+	write_imagef(image, (int2)(x, y), val/(float)sampleCount);
+}
+
+// adds the sample to the accumulated pixel and writes the average to the image,
+// with histogram coloring only the smooth iteration count is stored (-1 inside the set)
+inline void accumulate(__read_write image2d_t image, global float4* imageRaw, global float* smoothIterations, const float3 color, const int x, const int y,
+                       const int width, const int iterations, const int sampleCount, const int i, const float absolute PALETTE_PARAM)
+{
+#ifdef HISTOGRAM_COLORING
+	smoothIterations[y*width + x] = i == iterations ? -1.0f : smoothIteration(i, absolute);
+#else
+	if(i == iterations)
+		accumulateColor(image, imageRaw, x, y, width, sampleCount, (float4)(0.0f,0.0f,0.0f,1.0f));
+	else
+		accumulateColor(image, imageRaw, x, y, width, sampleCount, getColor(color,i,absolute PALETTE_ARG));
+#endif
+}
+
+//------------------------------------------------------------------------------
+// Escape loop
+//------------------------------------------------------------------------------
+
+// iterates z from iteration i on until |z|^2 exceeds MAX_ABSOLUTE or the iteration limit is reached,
+// returns the number of iterations, z is updated and the last |z|^2 is stored in absolute
+inline int iterate(real2* z, const real2 c, int i, const int iterations, real* absolute)
+{
+	real zx = z->x;
+	real zy = z->y;
+	const real cx = c.x;
+	const real cy = c.y;
+	real xx = zx * zx;
+	real yy = zy * zy;
+#if BAILOUT_UNROLL > 1
+	// check the bailout only every BAILOUT_UNROLL iterations, on an escape roll back to the last
+	// checked state and find the exact iteration one by one below. Escaped orbits don't come back
+	// (|z| > |c|) and overflows compare false, so nothing can be missed in between
+	while (i + BAILOUT_UNROLL <= iterations && xx + yy <= MAX_ABSOLUTE)
+	{
+		const real zxSaved = zx, zySaved = zy, xxSaved = xx, yySaved = yy;
+#pragma unroll
+		for (int j = 0; j < BAILOUT_UNROLL; ++j)
+			STEP(zx, zy, xx, yy, cx, cy);
+		if (!(xx + yy <= MAX_ABSOLUTE))
+		{
+			zx = zxSaved;
+			zy = zySaved;
+			xx = xxSaved;
+			yy = yySaved;
+			break;
+		}
+		i += BAILOUT_UNROLL;
+	}
+#endif
+	for (; i < iterations && xx + yy <= MAX_ABSOLUTE; ++i)
+		STEP(zx, zy, xx, yy, cx, cy);
+	*z = (real2)(zx, zy);
+	*absolute = xx + yy;
+	return i;
 }
 
-kernel void mandelbrot(__read_write image2d_t image, global float4* imageRaw, global uint4* randStates, const float3 color, const int width, const int height, const int iterations,
-                       const float zoom, const float2 pos, int sampleCount)
+// orbit of one pixel, z and the iteration count i are kept between launches.
+// Escaped pixels keep |z|^2 of their escape, pixel is the index in the image
+typedef struct
 {
+	real2 z;
+	real2 c;
+	int i;
+	uint pixel;
+} LivePixel;
+
+// stores the final orbit of the first sample, so it can be continued when the iteration limit is raised
+inline void storeState(global LivePixel* state, const uint pixel, const real2 z, const real2 c, const int i)
+{
+	LivePixel p;
+	p.z = z;
+	p.c = c;
+	p.i = i;
+	p.pixel = pixel;
+	state[pixel] = p;
+}
+
+// renders one sample of the pixel (x, y), returns its iteration count
+inline int renderPixel(__read_write image2d_t image, global float4* imageRaw, global float* smoothIterations, global uint4* randStates, global LivePixel* state,
+                        const float3 color, const int x, const int y, const int width, const int iterations, const real zoom, const real2 pos, const int sampleCount,
+                        const real2 juliaC PALETTE_PARAM)
+{
+	const uint imgIndex = y*width + x;
+	uint4 r = randStates[imgIndex];
+	real2 z = samplePoint(&r, x, y, width, zoom, pos);
+#if FORMULA == FORMULA_JULIA
+	const real2 c = juliaC;
+#else
+	const real2 c = z;
+#endif
+	real absolute;
+	const int i = iterate(&z, c, 0, iterations, &absolute);
+	randStates[imgIndex] = r;
+	if (sampleCount == 1)
+		storeState(state, imgIndex, z, c, i);
+
+	accumulate(image, imageRaw, smoothIterations, color, x, y, width, iterations, sampleCount, i, (float)absolute PALETTE_ARG);
+	return i;
+}
+
+kernel void fractal(__read_write image2d_t image, global float4* imageRaw, global float* smoothIterations, global uint4* randStates, global LivePixel* state, const float3 color,
+                    const int width, const int height, const int iterations, const real zoom, const real2 pos, int sampleCount, const real2 juliaC PALETTE_PARAM COUNTERS_PARAM)
+{
+	COUNTERS_BEGIN;
 	const int x = get_global_id(0);
 	const int y = get_global_id(1);
 	if (x < width && y < height)
+	{
+		const int i = renderPixel(image, imageRaw, smoothIterations, randStates, state, color, x, y, width, iterations, zoom, pos, sampleCount, juliaC PALETTE_ARG);
+		COUNT_ITERATIONS(i);
+		COUNT_PIXEL(i, iterations);
+	}
+	COUNTERS_END;
+}
+
+//------------------------------------------------------------------------------
+// Mirrored
+// formulas that commute with complex conjugation are symmetric about the real
+// axis. The host snaps pos so that the axis lies at axisRows / 2, then the
+// rows y and axisRows - 1 - y sample conjugate points with the vertical jitter
+// mirrored. The rows [skipFrom, skipTo) are the mirrors of computed rows, they
+// aren't launched but written together with their mirror
+//------------------------------------------------------------------------------
+
+kernel void fractal_mirrored(__read_write image2d_t image, global float4* imageRaw, global float* smoothIterations, global uint4* randStates, global LivePixel* state,
+                             const float3 color, const int width, const int height, const int iterations, const real zoom, const real2 pos, int sampleCount, const real2 juliaC,
+                             const int axisRows, const int skipFrom, const int skipTo PALETTE_PARAM COUNTERS_PARAM)
+{
+	COUNTERS_BEGIN;
+	const int x = get_global_id(0);
+	const int row = get_global_id(1);
+	const int y = row < skipFrom ? row : row + skipTo - skipFrom;
+	if (x < width && y < height)
 	{
 		const uint imgIndex = y*width + x;
 		uint4 r = randStates[imgIndex];
-		const int2 coords = (int2)(x, y);
-		const float r1 = 2.0f*rand(&r), dx = r1<1.0f ? sqrt(r1)-1.0f: 1.0f-sqrt(2.0f-r1);
-		const float r2 = 2.0f*rand(&r), dy = r2<1.0f ? sqrt(r2)-1.0f: 1.0f-sqrt(2.0f-r2);
-		const float xN = zoom * ((x + 0.5f + dx/2.0f) / width + pos.x);
-		const float yN = zoom * ((y + 0.5f + dy/2.0f) / width + pos.y);
-		const float maxAbsolute = 200.0f;
-		float xNtmp = xN;
-		float yNtmp = yN;
-		float xxN = xN * xN;
-		float yyN = yN * yN;
-		float xyN = xN * yN;
-		float absolute = xxN + yyN;
-		int i;
-		for (i = 0; i < iterations && absolute <= maxAbsolute; ++i)
-		{
-			xNtmp = xxN - yyN + xN;
-			yNtmp = xyN + xyN + yN;
-			xxN = xNtmp * xNtmp;
-			yyN = yNtmp * yNtmp;
-			xyN = xNtmp * yNtmp;
-			absolute = xxN + yyN;
-		}
-		float4 val;
-		if(i == iterations)
-			val = (sampleCount - 1 ? imageRaw[imgIndex] : (float4)(0.0f, 0.0f, 0.0f, 0.0f)) + (float4)(0.0f,0.0f,0.0f,1.0f);
-		else
-			val = (sampleCount - 1 ? imageRaw[imgIndex] : (float4)(0.0f, 0.0f, 0.0f, 0.0f)) + (float4)getColor(color,i,(float)absolute);
-		imageRaw[imgIndex] = val;
+		real2 z = samplePoint(&r, x, y, width, zoom, pos);
+#if FORMULA == FORMULA_JULIA
+		const real2 c = juliaC;
+#else
+		const real2 c = z;
+#endif
+		real absolute;
+		const int i = iterate(&z, c, 0, iterations, &absolute);
 		randStates[imgIndex] = r;
+		if (sampleCount == 1)
+			storeState(state, imgIndex, z, c, i);
+		accumulate(image, imageRaw, smoothIterations, color, x, y, width, iterations, sampleCount, i, (float)absolute PALETTE_ARG);
+		COUNT_ITERATIONS(i);
+		COUNT_PIXEL(i, iterations);
 
-		write_imagef(image, coords, val/(float)sampleCount);
+		const int mirror = axisRows - 1 - y;
+		if (mirror >= skipFrom && mirror < skipTo)
+		{
+			if (sampleCount == 1)
+				storeState(state, mirror*width + x, (real2)(z.x, -z.y), (real2)(c.x, -c.y), i);
+			accumulate(image, imageRaw, smoothIterations, color, x, mirror, width, iterations, sampleCount, i, (float)absolute PALETTE_ARG);
+			COUNT_PIXEL(i, iterations);
+		}
+	}
+	COUNTERS_END;
+}
+
+//------------------------------------------------------------------------------
+// Persistent threads
+// only a few work-groups are launched, they fetch blocks of
+// PERSISTENT_BLOCK x PERSISTENT_BLOCK pixels from a global counter until all
+// are done. The blocks are queued in Hilbert order, so consecutive blocks are
+// neighbours with a similar cost. The local size is at most PERSISTENT_BLOCK^2,
+// smaller work-groups render the pixels of a block in several rounds
+//------------------------------------------------------------------------------
+
+#define PERSISTENT_BLOCK 8
+
+kernel void fractal_persistent(__read_write image2d_t image, global float4* imageRaw, global float* smoothIterations, global uint4* randStates, global LivePixel* state,
+                               const float3 color, const int width, const int height, const int iterations, const real zoom, const real2 pos, int sampleCount, const real2 juliaC,
+                               global uint* blockCounter, global const uint2* blockOrder, const uint blockCount PALETTE_PARAM COUNTERS_PARAM)
+{
+	COUNTERS_BEGIN;
+	local uint block;
+	for (;;)
+	{
+		if (get_local_id(0) == 0)
+			block = atomic_inc(blockCounter);
+		barrier(CLK_LOCAL_MEM_FENCE);
+		const uint b = block;
+		// nobody may fetch the next block before everyone has read this one
+		barrier(CLK_LOCAL_MEM_FENCE);
+		if (b >= blockCount)
+			break;
+		for (uint p = get_local_id(0); p < PERSISTENT_BLOCK * PERSISTENT_BLOCK; p += get_local_size(0))
+		{
+			const int x = blockOrder[b].x * PERSISTENT_BLOCK + p % PERSISTENT_BLOCK;
+			const int y = blockOrder[b].y * PERSISTENT_BLOCK + p / PERSISTENT_BLOCK;
+			if (x < width && y < height)
+			{
+				const int i = renderPixel(image, imageRaw, smoothIterations, randStates, state, color, x, y, width, iterations, zoom, pos, sampleCount, juliaC PALETTE_ARG);
+				COUNT_ITERATIONS(i);
+				COUNT_PIXEL(i, iterations);
+			}
+		}
 	}
+	COUNTERS_END;
 }
 
-kernel void julia_set(__read_write image2d_t image, global float4* imageRaw, global uint4* randStates, const float3 color, const int width, const int height, const int iterations,
-                       const float zoom, const float2 pos, int sampleCount)
+//------------------------------------------------------------------------------
+// Wavefront
+// all pixels are iterated for a chunk of iterations, then the pixels that are
+// still bounded are compacted into a dense array with a prefix sum over the
+// alive flags and only those are launched again. Finished pixels are
+// accumulated right away
+//------------------------------------------------------------------------------
+
+kernel void wavefront_start(global LivePixel* live, global uint4* randStates, const int width, const int height,
+                            const real zoom, const real2 pos, const real2 juliaC)
 {
 	const int x = get_global_id(0);
 	const int y = get_global_id(1);
@@ -93,74 +488,765 @@ kernel void julia_set(__read_write image2d_t image, global float4* imageRaw, glo
 	{
 		const uint imgIndex = y*width + x;
 		uint4 r = randStates[imgIndex];
-		const int2 coords = (int2)(x, y);
-		const float r1 = 2.0f*rand(&r), dx = r1<1.0f ? sqrt(r1)-1.0f: 1.0f-sqrt(2.0f-r1);
-		const float r2 = 2.0f*rand(&r), dy = r2<1.0f ? sqrt(r2)-1.0f: 1.0f-sqrt(2.0f-r2);
-		const float xN = zoom * ((x + 0.5f + dx/2.0f) / width + pos.x);
-		const float yN = zoom * ((y + 0.5f + dy/2.0f) / width + pos.y);
-		const float maxAbsolute = 200.0f;
-		const float cr = -0.53060f;
-		const float ci = -0.50340f;
-		float xNtmp = xN;
-		float yNtmp = yN;
-		float xxN = xN * xN;
-		float yyN = yN * yN;
-		float xyN = xN * yN;
-		float absolute = xxN + yyN;
-		int i;
-		for (i = 0; i < iterations && absolute <= maxAbsolute; ++i)
-		{
-			xNtmp = xxN - yyN + cr;
-			yNtmp = xyN + xyN + ci;
-			xxN = xNtmp * xNtmp;
-			yyN = yNtmp * yNtmp;
-			xyN = xNtmp * yNtmp;
-			absolute = sqrt(xxN + yyN);
-		}
-		float4 val;
-		if(i == iterations)
-			val = (sampleCount - 1 ? imageRaw[imgIndex] : (float4)(0.0f, 0.0f, 0.0f, 0.0f)) + (float4)(0.0f,0.0f,0.0f,1.0f);
-		else
-			val = (sampleCount - 1 ? imageRaw[imgIndex] : (float4)(0.0f, 0.0f, 0.0f, 0.0f)) + (float4)getColor(color,i,(float)absolute);
-		imageRaw[imgIndex] = val;
+		LivePixel p;
+		p.z = samplePoint(&r, x, y, width, zoom, pos);
+#if FORMULA == FORMULA_JULIA
+		p.c = juliaC;
+#else
+		p.c = p.z;
+#endif
+		p.i = 0;
+		p.pixel = imgIndex;
+		live[imgIndex] = p;
 		randStates[imgIndex] = r;
+	}
+}
 
-		write_imagef(image, coords, val/(float)sampleCount);
+kernel void wavefront_iterate(__read_write image2d_t image, global float4* imageRaw, global float* smoothIterations, global LivePixel* live, global uint* alive,
+                              global LivePixel* state, const float3 color, const int width, const uint count, const int iterations, const int chunk, int sampleCount PALETTE_PARAM COUNTERS_PARAM)
+{
+	COUNTERS_BEGIN;
+	const uint id = get_global_id(0);
+	if (id < count)
+	{
+		LivePixel p = live[id];
+		const int start = p.i;
+		real absolute;
+		p.i = iterate(&p.z, p.c, p.i, min(iterations, p.i + chunk), &absolute);
+		COUNT_ITERATIONS(p.i - start);
+		if (p.i == iterations || !(absolute <= MAX_ABSOLUTE))
+		{
+			alive[id] = 0;
+			if (sampleCount == 1)
+				state[p.pixel] = p;
+			accumulate(image, imageRaw, smoothIterations, color, p.pixel % width, p.pixel / width, width, iterations, sampleCount, p.i, (float)absolute PALETTE_ARG);
+			COUNT_PIXEL(p.i, iterations);
+		}
+		else
+		{
+			alive[id] = 1;
+			live[id] = p;
+		}
 	}
+	COUNTERS_END;
 }
 
-kernel void mandelbrot_alt(__read_write image2d_t image, global float4* imageRaw, global uint4* randStates, const float3 color, const int width, const int height, const int iterations,
-						   const float zoom, const float2 pos, int sampleCount)
+kernel void wavefront_compact(global const LivePixel* live, global LivePixel* compacted, global const uint* alive, global const uint* offsets,
+                              global uint* liveCount, const uint count)
 {
+	const uint id = get_global_id(0);
+	if (id < count)
+	{
+		if (alive[id])
+			compacted[offsets[id]] = live[id];
+		if (id == count - 1)
+			*liveCount = offsets[id] + alive[id];
+	}
+}
+
+//------------------------------------------------------------------------------
+// Chunked iteration
+// deep samples are split into several launches of at most chunk iterations,
+// the state of every pixel is kept in a LivePixel buffer in between, which is
+// initialized by wavefront_start. All still bounded pixels have reached the
+// iteration from, the ones that stopped before have escaped. A raised iteration
+// limit continues the stored state of the last sample the same way, the first
+// launch then recolors the escaped pixels
+//------------------------------------------------------------------------------
+
+kernel void chunk_iterate(__read_write image2d_t image, global float4* imageRaw, global float* smoothIterations, global LivePixel* state, const float3 color,
+                          const int width, const int height, const int iterations, const int from, const int chunk, const int recolor, int sampleCount PALETTE_PARAM COUNTERS_PARAM)
+{
+	COUNTERS_BEGIN;
 	const int x = get_global_id(0);
 	const int y = get_global_id(1);
 	if (x < width && y < height)
 	{
-		int i;
-
 		const uint imgIndex = y*width + x;
-		uint4 r = randStates[imgIndex];
-		const int2 coords = (int2)(x, y);
-		const float r1 = 2.0f*rand(&r), dx = r1<1.0f ? sqrt(r1)-1.0f: 1.0f-sqrt(2.0-r1);
-		const float r2 = 2.0f*rand(&r), dy = r2<1.0f ? sqrt(r2)-1.0f: 1.0f-sqrt(2.0f-r2);
-		float2 z = (float2)(0.0f, 0.0f);
-		const float2 c = (float2)((float) zoom * ((float) (x + 0.5f + dx/2.0f) / width + pos.x),
-		                            (float) zoom * ((float) (y + 0.5f + dy/2.0f) / width + pos.y));
-		const float maxAbsolute = 200.0f;
-		float absolute;
-		for (i = 0; i < iterations && (absolute = dot(z, z)) <= maxAbsolute; i++)
-		{
-			z = complexMul(z, z) + c;
-		}
-		float4 val;
-		if(i == iterations)
-			val = (sampleCount - 1 ? imageRaw[imgIndex] : (float4)(0.0f, 0.0f, 0.0f, 0.0f)) + (float4)(0.0f,0.0f,0.0f,1.0f);
+		LivePixel p = state[imgIndex];
+		// escaped in an earlier launch, possibly in the very last iteration of it
+		if (p.i < from || (from > 0 && !(dot(p.z, p.z) <= MAX_ABSOLUTE)))
+		{
+			if (recolor)
+			{
+				accumulate(image, imageRaw, smoothIterations, color, x, y, width, iterations, sampleCount, p.i, (float)dot(p.z, p.z) PALETTE_ARG);
+				COUNT_PIXEL(p.i, iterations);
+			}
+		}
 		else
-			val = (sampleCount - 1 ? imageRaw[imgIndex] : (float4)(0.0f, 0.0f, 0.0f, 0.0f)) + (float4)getColor(color,i,(float)absolute);
-		imageRaw[imgIndex] = val;
-		randStates[imgIndex] = r;
+		{
+			const int start = p.i;
+			real absolute;
+			p.i = iterate(&p.z, p.c, p.i, min(iterations, from + chunk), &absolute);
+			COUNT_ITERATIONS(p.i - start);
+			if (p.i == iterations || !(absolute <= MAX_ABSOLUTE))
+			{
+				accumulate(image, imageRaw, smoothIterations, color, x, y, width, iterations, sampleCount, p.i, (float)absolute PALETTE_ARG);
+				COUNT_PIXEL(p.i, iterations);
+			}
+			state[imgIndex] = p;
+		}
+	}
+	COUNTERS_END;
+}
 
-		write_imagef(image, coords, val/(float)sampleCount);
+//------------------------------------------------------------------------------
+// Tiles
+// the plane is divided into a quadtree of TILE_SIZE x TILE_SIZE tiles, the
+// tile (x, y) of level l covers origin + [x, x + 1) * rootExtent / 2^l. The
+// jobs of tile_render are (x, y, level, atlas slot). The host caches their smooth
+// iteration counts (-1 inside the set) and uploads the visible ones as a grid
+// into an atlas, the missing ones are rendered into it by tile_render in one
+// batch. tile_compose resamples the atlas into the view, tile_colorize turns
+// the tiles into RGBA8 images for the tile server
+//------------------------------------------------------------------------------
+
+#define TILE_SIZE 256
+
+kernel void tile_render(global float* atlas, global const long4* jobs, const real2 origin, const real rootExtent,
+                        const int iterations, const real2 juliaC)
+{
+	const int x = get_global_id(0);
+	const int y = get_global_id(1);
+	const long4 job = jobs[get_global_id(2)];
+	const real2 tile = convert_real2(job.xy);
+	const real extent = ldexp(rootExtent, -(int)job.z);
+	real2 z = origin + (real2)(tile.x * extent + (x + R(0.5)) * extent / TILE_SIZE, tile.y * extent + (y + R(0.5)) * extent / TILE_SIZE);
+#if FORMULA == FORMULA_JULIA
+	const real2 c = juliaC;
+#else
+	const real2 c = z;
+#endif
+	real absolute;
+	const int i = iterate(&z, c, 0, iterations, &absolute);
+	atlas[(job.w * TILE_SIZE + y) * TILE_SIZE + x] = i == iterations ? -1.0f : smoothIteration(i, (float)absolute);
+}
+
+kernel void tile_colorize(global const float* atlas, global uchar4* rgba, const float3 color, const uint n PALETTE_PARAM)
+{
+	const uint id = get_global_id(0);
+	if (id < n)
+		rgba[id] = convert_uchar4_sat(smoothColor(color, atlas[id] PALETTE_ARG) * 255.0f);
+}
+
+// texel (x, y) of the atlas grid, clamped to its border
+inline float atlasTexel(global const float* atlas, const int gridWidth, const int gridHeight, int x, int y)
+{
+	x = clamp(x, 0, gridWidth * TILE_SIZE - 1);
+	y = clamp(y, 0, gridHeight * TILE_SIZE - 1);
+	const int slot = (y / TILE_SIZE) * gridWidth + x / TILE_SIZE;
+	return atlas[(slot * TILE_SIZE + y % TILE_SIZE) * TILE_SIZE + x % TILE_SIZE];
+}
+
+kernel void tile_compose(__read_write image2d_t image, global float4* imageRaw, global float* smoothIterations, global const float* atlas,
+                         const float3 color, const int width, const int height, const real zoom, const real2 pos, const real2 gridOrigin,
+                         const real extent, const int gridWidth, const int gridHeight PALETTE_PARAM)
+{
+	const int x = get_global_id(0);
+	const int y = get_global_id(1);
+	if (x < width && y < height)
+	{
+		const real2 c = (real2)(zoom * ((x + R(0.5)) / width + pos.x), zoom * ((y + R(0.5)) / width + pos.y));
+		const real2 texel = (c - gridOrigin) * (TILE_SIZE / extent) - R(0.5);
+		const int2 t = convert_int2(floor(texel));
+		const float2 f = convert_float2(texel - floor(texel));
+#ifdef HISTOGRAM_COLORING
+		smoothIterations[y*width + x] = atlasTexel(atlas, gridWidth, gridHeight, (int)round(texel.x), (int)round(texel.y));
+#else
+		// the tiles have up to twice the resolution of the view, interpolate the colors of the four nearest texels
+		const float4 top = mix(smoothColor(color, atlasTexel(atlas, gridWidth, gridHeight, t.x, t.y) PALETTE_ARG),
+		                       smoothColor(color, atlasTexel(atlas, gridWidth, gridHeight, t.x + 1, t.y) PALETTE_ARG), f.x);
+		const float4 bottom = mix(smoothColor(color, atlasTexel(atlas, gridWidth, gridHeight, t.x, t.y + 1) PALETTE_ARG),
+		                          smoothColor(color, atlasTexel(atlas, gridWidth, gridHeight, t.x + 1, t.y + 1) PALETTE_ARG), f.x);
+		accumulateColor(image, imageRaw, x, y, width, 1, mix(top, bottom, f.y));
+#endif
+	}
+}
+
+//------------------------------------------------------------------------------
+// Viewport batches
+// many small square views in one launch, e.g. a grid of Julia sets or
+// thumbnails. Every viewport has its own parameters, the pixel (x, y) of
+// viewport v is at origin + ((x, y) + 0.5) * extent / size and its smooth
+// iteration count is stored in slot v of the atlas, which tile_colorize turns
+// into RGBA8
+//------------------------------------------------------------------------------
+
+typedef struct
+{
+	real2 origin;
+	real2 juliaC;
+	real extent;
+	int iterations;
+} Viewport;
+
+kernel void viewports_render(global float* atlas, global const Viewport* viewports, const int size)
+{
+	const int x = get_global_id(0);
+	const int y = get_global_id(1);
+	const int v = get_global_id(2);
+	const Viewport view = viewports[v];
+	real2 z = view.origin + (real2)(x + R(0.5), y + R(0.5)) * view.extent / size;
+#if FORMULA == FORMULA_JULIA
+	const real2 c = view.juliaC;
+#else
+	const real2 c = z;
+#endif
+	real absolute;
+	const int i = iterate(&z, c, 0, view.iterations, &absolute);
+	atlas[(v * size + y) * size + x] = i == view.iterations ? -1.0f : smoothIteration(i, (float)absolute);
+}
+
+//------------------------------------------------------------------------------
+// Iteration field export
+// the smooth iteration count (-1 inside the set) and the final |z| of the
+// stored pixel state in the tiled layout of the field files, see
+// IterationField.hpp. One launch writes one row of tiles starting at the image
+// row bandY, texels outside the image are 0
+//------------------------------------------------------------------------------
+
+inline float2 fieldValues(global const LivePixel* state, const int x, const int y, const int width, const int height, const int iterations)
+{
+	if (x >= width || y >= height)
+		return (float2)(0.0f, 0.0f);
+	const LivePixel p = state[y*width + x];
+	const float absolute = (float)dot(p.z, p.z);
+	return (float2)(p.i >= iterations ? -1.0f : smoothIteration(p.i, absolute), sqrt(absolute));
+}
+
+// index of the first channel of the pixel in the band
+inline uint fieldIndex(const int x, const int y, const int tileSize)
+{
+	return (((x / tileSize) * tileSize + y % tileSize) * tileSize + x % tileSize) * 2;
+}
+
+kernel void export_field(global const LivePixel* state, global float* band, const int width, const int height, const int iterations,
+                         const int tileSize, const int bandY)
+{
+	const int x = get_global_id(0);
+	const int y = bandY + get_global_id(1);
+	vstore2(fieldValues(state, x, y, width, height, iterations), 0, band + fieldIndex(x, y, tileSize));
+}
+
+kernel void export_field_half(global const LivePixel* state, global half* band, const int width, const int height, const int iterations,
+                              const int tileSize, const int bandY)
+{
+	const int x = get_global_id(0);
+	const int y = bandY + get_global_id(1);
+	vstore_half2(fieldValues(state, x, y, width, height, iterations), 0, band + fieldIndex(x, y, tileSize));
+}
+
+//------------------------------------------------------------------------------
+// Resolve
+// averages the accumulated samples, applies the tone curve and quantizes to
+// RGBA8, so only 4 bytes per pixel are read back
+//------------------------------------------------------------------------------
+
+#define TONE_LINEAR 0
+#define TONE_GAMMA 1
+#define TONE_FILMIC 2
+
+kernel void resolve(global const float4* imageRaw, global uchar4* rgba, const int sampleCount, const uint n, const int toneCurve)
+{
+	const uint id = get_global_id(0);
+	if (id < n)
+	{
+		const float4 average = imageRaw[id] / (float)sampleCount;
+		float3 c = max(average.xyz, 0.0f);
+		if (toneCurve == TONE_FILMIC)
+			// ACES fit of Krzysztof Narkowicz, followed by the display gamma
+			c = clamp((c * (2.51f * c + 0.03f)) / (c * (2.43f * c + 0.59f) + 0.14f), 0.0f, 1.0f);
+		if (toneCurve != TONE_LINEAR)
+			c = pow(c, 1.0f / 2.2f);
+		rgba[id] = convert_uchar4_sat_rte((float4)(c, average.w) * 255.0f);
+	}
+}
+
+//------------------------------------------------------------------------------
+// Convergence
+// counts the pixels whose average moved by more than half an 8 bit step in any
+// channel with the last sample and keeps the accumulated samples in
+// previousRaw for the comparison with the next one. With a sampleCount of 1
+// they are only copied
+//------------------------------------------------------------------------------
+
+#define CONVERGED_CHANGE (0.5f / 255.0f)
+
+kernel void sample_change(global const float4* imageRaw, global float4* previousRaw, global uint* changed, const int sampleCount, const uint n)
+{
+	local uint groupChanged;
+	if (get_local_id(0) == 0)
+		groupChanged = 0;
+	barrier(CLK_LOCAL_MEM_FENCE);
+	uint count = 0;
+	for (uint id = get_global_id(0); id < n; id += get_global_size(0))
+	{
+		const float4 sum = imageRaw[id];
+		if (sampleCount > 1)
+		{
+			const float4 change = fabs(sum / (float)sampleCount - previousRaw[id] / (float)(sampleCount - 1));
+			count += max(max(change.x, change.y), max(change.z, change.w)) > CONVERGED_CHANGE;
+		}
+		previousRaw[id] = sum;
+	}
+	atomic_add(&groupChanged, count);
+	barrier(CLK_LOCAL_MEM_FENCE);
+	if (get_local_id(0) == 0)
+		atomic_add(changed, groupChanged);
+}
+
+//------------------------------------------------------------------------------
+// Prefix sum
+// work-efficient exclusive scan (Blelloch) of 2 * SCAN_BLOCK elements per
+// work-group, the host scans the block sums recursively and adds them back.
+// The local size has to be SCAN_BLOCK
+//------------------------------------------------------------------------------
+
+#define SCAN_BLOCK 256
+
+kernel void scan_blocks(global const uint* in, global uint* out, global uint* blockSums, const uint n)
+{
+	local uint temp[2 * SCAN_BLOCK];
+	const uint lid = get_local_id(0);
+	const uint offset = get_group_id(0) * 2 * SCAN_BLOCK;
+	temp[2*lid] = offset + 2*lid < n ? in[offset + 2*lid] : 0;
+	temp[2*lid + 1] = offset + 2*lid + 1 < n ? in[offset + 2*lid + 1] : 0;
+
+	// up-sweep, builds partial sums in place
+	uint d = 1;
+	for (uint s = SCAN_BLOCK; s > 0; s >>= 1)
+	{
+		barrier(CLK_LOCAL_MEM_FENCE);
+		if (lid < s)
+			temp[d*(2*lid + 2) - 1] += temp[d*(2*lid + 1) - 1];
+		d <<= 1;
+	}
+	if (lid == 0)
+	{
+		blockSums[get_group_id(0)] = temp[2*SCAN_BLOCK - 1];
+		temp[2*SCAN_BLOCK - 1] = 0;
+	}
+	// down-sweep, distributes the partial sums
+	for (uint s = 1; s <= SCAN_BLOCK; s <<= 1)
+	{
+		d >>= 1;
+		barrier(CLK_LOCAL_MEM_FENCE);
+		if (lid < s)
+		{
+			const uint t = temp[d*(2*lid + 1) - 1];
+			temp[d*(2*lid + 1) - 1] = temp[d*(2*lid + 2) - 1];
+			temp[d*(2*lid + 2) - 1] += t;
+		}
+	}
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	if (offset + 2*lid < n)
+		out[offset + 2*lid] = temp[2*lid];
+	if (offset + 2*lid + 1 < n)
+		out[offset + 2*lid + 1] = temp[2*lid + 1];
+}
+
+kernel void scan_add(global uint* data, global const uint* blockSums, const uint n)
+{
+	const uint id = get_global_id(0);
+	if (id < n)
+		data[id] += blockSums[id / (2 * SCAN_BLOCK)];
+}
+
+//------------------------------------------------------------------------------
+// Orbit density (Buddhabrot)
+// random c are drawn from the square DENSITY_REGION around the origin, or with
+// importance sampling uniformly from the cells of a DENSITY_CELLS^2 grid over
+// it which lie near the boundary of the set (marked by density_cells, dilated
+// on the host). The orbits that escape are traced a second time and every
+// point is counted in the pixel it falls into. Instead of one global atomic per
+// point, every work-group merges its points in a local hash table of pixels,
+// which is flushed to the global grid after every round of DENSITY_BATCH
+// points per work-item. Points that find no free slot go to the grid directly.
+// The counts of a launch are added to stats: c values tested, escaping orbits,
+// points and the highest density (set by density_max)
+//------------------------------------------------------------------------------
+
+#define DENSITY_REGION R(4.0)
+#define DENSITY_CELLS 512
+#define DENSITY_BATCH 16
+// c values tested per round at most, before the round goes on without an orbit
+#define DENSITY_TRIES 4
+#define DENSITY_BIN_BITS 11
+#define DENSITY_BINS (1 << DENSITY_BIN_BITS)
+#define DENSITY_PROBES 8
+#define DENSITY_EMPTY 0xFFFFFFFF
+#define DENSITY_TESTED 0
+#define DENSITY_ORBITS 1
+#define DENSITY_POINTS 2
+#define DENSITY_MAX 3
+
+kernel void density_cells(global uchar* boundary, const int iterations, const real2 juliaC)
+{
+	const int x = get_global_id(0);
+	const int y = get_global_id(1);
+	if (x < DENSITY_CELLS && y < DENSITY_CELLS)
+	{
+		// a cell contains the boundary if some of its 4x4 points escape and some don't
+		const real cellSize = DENSITY_REGION / DENSITY_CELLS;
+		int escaped = 0;
+		for (int s = 0; s < 16; ++s)
+		{
+			real2 z = (real2)(-DENSITY_REGION / R(2.0) + (x + (s % 4 + R(0.5)) / R(4.0)) * cellSize,
+			                  -DENSITY_REGION / R(2.0) + (y + (s / 4 + R(0.5)) / R(4.0)) * cellSize);
+#if FORMULA == FORMULA_JULIA
+			const real2 c = juliaC;
+#else
+			const real2 c = z;
+#endif
+			real absolute;
+			if (iterate(&z, c, 0, iterations, &absolute) < iterations)
+				++escaped;
+		}
+		boundary[y*DENSITY_CELLS + x] = escaped > 0 && escaped < 16;
+	}
+}
+
+inline real2 densitySample(uint4* r, global const uint* cells, const uint cellCount)
+{
+	const real u = rand(r);
+	const real v = rand(r);
+	if (!cellCount)
+		return (real2)((u - R(0.5)) * DENSITY_REGION, (v - R(0.5)) * DENSITY_REGION);
+	const uint cell = cells[min((uint)(rand(r) * cellCount), cellCount - 1)];
+	return (real2)(-DENSITY_REGION / R(2.0) + (cell % DENSITY_CELLS + u) * DENSITY_REGION / DENSITY_CELLS,
+	               -DENSITY_REGION / R(2.0) + (cell / DENSITY_CELLS + v) * DENSITY_REGION / DENSITY_CELLS);
+}
+
+inline void densitySplat(local uint* binPixels, local uint* binCounts, global uint* density, const real zx, const real zy,
+                         const int width, const int height, const real zoom, const real2 pos)
+{
+	// the inverse of samplePoint, the comparisons are false for points that overflowed
+	const real fx = (zx / zoom - pos.x) * width;
+	const real fy = (zy / zoom - pos.y) * width;
+	if (!(fx >= R(0.0) && fx < width && fy >= R(0.0) && fy < height))
+		return;
+	const uint pixel = (uint)fy * width + (uint)fx;
+	uint bin = (pixel * 2654435761u) >> (32 - DENSITY_BIN_BITS);
+	for (int probe = 0; probe < DENSITY_PROBES; ++probe, bin = (bin + 1) & (DENSITY_BINS - 1))
+	{
+		const uint old = atomic_cmpxchg(&binPixels[bin], DENSITY_EMPTY, pixel);
+		if (old == DENSITY_EMPTY || old == pixel)
+		{
+			atomic_inc(&binCounts[bin]);
+			return;
+		}
+	}
+	atomic_inc(&density[pixel]);
+}
+
+kernel void density_splat(global uint* density, global uint4* randStates, global const uint* cells, const uint cellCount, global uint* stats,
+                          const int width, const int height, const int iterations, const real zoom, const real2 pos, const int rounds, const real2 juliaC)
+{
+	local uint binPixels[DENSITY_BINS];
+	local uint binCounts[DENSITY_BINS];
+	local uint groupStats[3];
+	const uint lid = get_local_id(0);
+	for (uint bin = lid; bin < DENSITY_BINS; bin += get_local_size(0))
+	{
+		binPixels[bin] = DENSITY_EMPTY;
+		binCounts[bin] = 0;
+	}
+	if (lid < 3)
+		groupStats[lid] = 0;
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	uint4 r = randStates[get_global_id(0)];
+	// the orbit being traced, with the number of points left
+	real zx = R(0.0), zy = R(0.0), xx = R(0.0), yy = R(0.0), cx = R(0.0), cy = R(0.0);
+	int remaining = 0;
+	for (int round = 0; round < rounds; ++round)
+	{
+		for (int t = 0; t < DENSITY_TRIES && remaining == 0; ++t)
+		{
+			const real2 start = densitySample(&r, cells, cellCount);
+#if FORMULA == FORMULA_JULIA
+			const real2 c = juliaC;
+#else
+			const real2 c = start;
+#endif
+			real2 z = start;
+			real absolute;
+			const int i = iterate(&z, c, 0, iterations, &absolute);
+			atomic_inc(&groupStats[DENSITY_TESTED]);
+			if (i < iterations)
+			{
+				atomic_inc(&groupStats[DENSITY_ORBITS]);
+				zx = start.x;
+				zy = start.y;
+				xx = zx * zx;
+				yy = zy * zy;
+				cx = c.x;
+				cy = c.y;
+				remaining = i;
+			}
+		}
+		uint points = 0;
+		for (; points < DENSITY_BATCH && remaining > 0; ++points, --remaining)
+		{
+			STEP(zx, zy, xx, yy, cx, cy);
+			densitySplat(binPixels, binCounts, density, zx, zy, width, height, zoom, pos);
+		}
+		if (points)
+			atomic_add(&groupStats[DENSITY_POINTS], points);
+
+		// merge the table into the grid, every pixel costs one atomic however often it was hit
+		barrier(CLK_LOCAL_MEM_FENCE);
+		for (uint bin = lid; bin < DENSITY_BINS; bin += get_local_size(0))
+			if (binPixels[bin] != DENSITY_EMPTY)
+			{
+				atomic_add(&density[binPixels[bin]], binCounts[bin]);
+				binPixels[bin] = DENSITY_EMPTY;
+				binCounts[bin] = 0;
+			}
+		barrier(CLK_LOCAL_MEM_FENCE);
+	}
+	randStates[get_global_id(0)] = r;
+	if (lid < 3)
+		atomic_add(&stats[lid], groupStats[lid]);
+}
+
+kernel void density_max(global const uint* density, global uint* stats, const uint n)
+{
+	local uint groupMax;
+	if (get_local_id(0) == 0)
+		groupMax = 0;
+	barrier(CLK_LOCAL_MEM_FENCE);
+	uint highest = 0;
+	for (uint id = get_global_id(0); id < n; id += get_global_size(0))
+		highest = max(highest, density[id]);
+	atomic_max(&groupMax, highest);
+	barrier(CLK_LOCAL_MEM_FENCE);
+	if (get_local_id(0) == 0)
+		atomic_max(&stats[DENSITY_MAX], groupMax);
+}
+
+kernel void density_color(__read_write image2d_t image, global float4* imageRaw, global const uint* density, global const uint* stats,
+                          const float3 color, const int width, const int height, int sampleCount PALETTE_PARAM)
+{
+	const int x = get_global_id(0);
+	const int y = get_global_id(1);
+	if (x < width && y < height)
+	{
+		const uint imgIndex = y*width + x;
+		const float v = sqrt((float)density[imgIndex] / max(1u, stats[DENSITY_MAX]));
+		const float4 val = (float4)(v * palette(color, v PALETTE_ARG).xyz, 1.0f);
+		// the samples are already accumulated in the density, resolve divides by the sample count
+		imageRaw[imgIndex] = val * (float)sampleCount;
+		write_imagef(image, (int2)(x, y), val);
+	}
+}
+
+//------------------------------------------------------------------------------
+// Histogram coloring
+// the smooth iteration counts of the frame are binned over their range in the
+// frame into per work-group local histograms, which are merged atomically, so
+// the bins stay fine at deep iteration limits. The exclusive prefix sum of
+// the histogram is the CDF, every pixel is colored by the fraction of escaped
+// pixels with a lower count, so the palette is spread evenly at any depth
+//------------------------------------------------------------------------------
+
+#define HISTOGRAM_BINS 4096
+
+// range holds the bits of the lowest and highest escaped count, non-negative floats order like their bits
+inline float histogramPosition(const float smooth, global const uint* range)
+{
+	const float low = as_float(range[0]);
+	const float span = as_float(range[1]) - low;
+	return span > 0.0f ? clamp((smooth - low) / span, 0.0f, 1.0f) * (HISTOGRAM_BINS - 1) : 0.0f;
+}
+
+kernel void histogram_range(global const float* smoothIterations, global uint* range, const uint n)
+{
+	local uint low;
+	local uint high;
+	if (get_local_id(0) == 0)
+	{
+		low = UINT_MAX;
+		high = 0;
+	}
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	uint itemLow = UINT_MAX;
+	uint itemHigh = 0;
+	for (uint id = get_global_id(0); id < n; id += get_global_size(0))
+	{
+		const float smooth = smoothIterations[id];
+		if (smooth >= 0.0f)
+		{
+			itemLow = min(itemLow, as_uint(smooth));
+			itemHigh = max(itemHigh, as_uint(smooth));
+		}
+	}
+	atomic_min(&low, itemLow);
+	atomic_max(&high, itemHigh);
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	if (get_local_id(0) == 0)
+	{
+		atomic_min(&range[0], low);
+		atomic_max(&range[1], high);
+	}
+}
+
+kernel void histogram_build(global const float* smoothIterations, global uint* histogram, const uint n, global const uint* range)
+{
+	local uint localHistogram[HISTOGRAM_BINS];
+	for (uint bin = get_local_id(0); bin < HISTOGRAM_BINS; bin += get_local_size(0))
+		localHistogram[bin] = 0;
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	for (uint id = get_global_id(0); id < n; id += get_global_size(0))
+	{
+		const float smooth = smoothIterations[id];
+		if (smooth >= 0.0f)
+			atomic_inc(&localHistogram[(uint)histogramPosition(smooth, range)]);
+	}
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	for (uint bin = get_local_id(0); bin < HISTOGRAM_BINS; bin += get_local_size(0))
+		if (localHistogram[bin])
+			atomic_add(&histogram[bin], localHistogram[bin]);
+}
+
+kernel void histogram_color(__read_write image2d_t image, global float4* imageRaw, global const float* smoothIterations, global const uint* histogram,
+                            global const uint* cdf, const float3 color, const int width, const int height, global const uint* range, int sampleCount PALETTE_PARAM)
+{
+	const int x = get_global_id(0);
+	const int y = get_global_id(1);
+	if (x < width && y < height)
+	{
+		const float smooth = smoothIterations[y*width + x];
+		if (smooth < 0.0f)
+		{
+			accumulateColor(image, imageRaw, x, y, width, sampleCount, (float4)(0.0f,0.0f,0.0f,1.0f));
+			return;
+		}
+		// interpolate inside the bin, so the coloring stays continuous
+		const float position = histogramPosition(smooth, range);
+		const uint bin = (uint)position;
+		const float total = (float)(cdf[HISTOGRAM_BINS - 1] + histogram[HISTOGRAM_BINS - 1]);
+		const float rank = ((float)cdf[bin] + (position - bin) * histogram[bin]) / total;
+		accumulateColor(image, imageRaw, x, y, width, sampleCount, palette(color, rank PALETTE_ARG));
+	}
+}
+
+//------------------------------------------------------------------------------
+// Vectorized variant
+// every work-item iterates a strip of VEC_WIDTH horizontally adjacent pixels,
+// VEC_WIDTH is set by the host from the preferred vector width of the device
+//------------------------------------------------------------------------------
+
+#ifdef VEC_WIDTH
+
+// like iterate, escaped lanes keep iterating until all lanes are done but their count and |z|^2 are frozen,
+// so z is only meaningful for the lanes that reached the iteration limit
+inline maskN iterateN(realN* z_x, realN* z_y, const realN cx, const realN cy, const int iterations, realN* escapeAbsolute)
+{
+	realN zx = *z_x;
+	realN zy = *z_y;
+	realN xx = zx * zx;
+	realN yy = zy * zy;
+	int i = 0;
+#if BAILOUT_UNROLL > 1
+	// unchecked blocks as long as no lane escapes, the masked loop below finishes the strip
+	while (i + BAILOUT_UNROLL <= iterations && all(xx + yy <= MAX_ABSOLUTE))
+	{
+		const realN zxSaved = zx, zySaved = zy, xxSaved = xx, yySaved = yy;
+#pragma unroll
+		for (int j = 0; j < BAILOUT_UNROLL; ++j)
+			STEP(zx, zy, xx, yy, cx, cy);
+		if (!all(xx + yy <= MAX_ABSOLUTE))
+		{
+			zx = zxSaved;
+			zy = zySaved;
+			xx = xxSaved;
+			yy = yySaved;
+			break;
+		}
+		i += BAILOUT_UNROLL;
+	}
+#endif
+	realN absolute = xx + yy;
+	*escapeAbsolute = absolute;
+	maskN active = absolute <= MAX_ABSOLUTE;
+	maskN count = (maskN)(i);
+	for (; i < iterations && any(active); ++i)
+	{
+		STEP(zx, zy, xx, yy, cx, cy);
+		absolute = xx + yy;
+		count -= active;
+		*escapeAbsolute = select(*escapeAbsolute, absolute, active);
+		active &= absolute <= MAX_ABSOLUTE;
+	}
+	*z_x = zx;
+	*z_y = zy;
+	return count;
+}
+
+kernel void fractal_vec(__read_write image2d_t image, global float4* imageRaw, global float* smoothIterations, global uint4* randStates, global LivePixel* state,
+                        const float3 color, const int width, const int height, const int iterations, const real zoom, const real2 pos, int sampleCount, const real2 juliaC
+                        PALETTE_PARAM COUNTERS_PARAM)
+{
+	COUNTERS_BEGIN;
+	const int x0 = get_global_id(0) * VEC_WIDTH;
+	const int y = get_global_id(1);
+	if (x0 < width && y < height)
+	{
+		uint4 r[VEC_WIDTH];
+		real xs[VEC_WIDTH], ys[VEC_WIDTH];
+		for (int l = 0; l < VEC_WIDTH; ++l)
+		{
+			// lanes past the right border are computed but never written back
+			r[l] = randStates[y*width + min(x0 + l, width - 1)];
+			const real2 z = samplePoint(&r[l], x0 + l, y, width, zoom, pos);
+			xs[l] = z.x;
+			ys[l] = z.y;
+		}
+		realN zx = vloadN(0, xs);
+		realN zy = vloadN(0, ys);
+#if FORMULA == FORMULA_JULIA
+		const realN cx = (realN)(juliaC.x);
+		const realN cy = (realN)(juliaC.y);
+#else
+		const realN cx = zx;
+		const realN cy = zy;
+#endif
+		realN absolute;
+		const maskN count = iterateN(&zx, &zy, cx, cy, iterations, &absolute);
+
+		real absolutes[VEC_WIDTH];
+		mask counts[VEC_WIDTH];
+		vstoreN(absolute, 0, absolutes);
+		vstoreN(count, 0, counts);
+		real zxs[VEC_WIDTH], zys[VEC_WIDTH];
+		vstoreN(zx, 0, zxs);
+		vstoreN(zy, 0, zys);
+		for (int l = 0; l < VEC_WIDTH && x0 + l < width; ++l)
+		{
+			randStates[y*width + x0 + l] = r[l];
+			if (sampleCount == 1)
+			{
+				// the z of escaped lanes ran on, only their |z|^2 at the escape is kept
+#if FORMULA == FORMULA_JULIA
+				const real2 c = juliaC;
+#else
+				const real2 c = (real2)(xs[l], ys[l]);
+#endif
+				const real2 z = counts[l] == iterations ? (real2)(zxs[l], zys[l]) : (real2)(sqrt(absolutes[l]), R(0.0));
+				storeState(state, y*width + x0 + l, z, c, (int)counts[l]);
+			}
+			accumulate(image, imageRaw, smoothIterations, color, x0 + l, y, width, iterations, sampleCount, (int)counts[l], (float)absolutes[l] PALETTE_ARG);
+			COUNT_ITERATIONS((int)counts[l]);
+			COUNT_PIXEL((int)counts[l], iterations);
+		}
 	}
+	COUNTERS_END;
 }
 
+#endif
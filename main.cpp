@@ -1,20 +1,137 @@
 #include <iostream>
 #include <ctime>
 #include <string>
+#include <sstream>
+#include <cstring>
+#include <vector>
+#include <algorithm>
 #include <SDL2/SDL.h>
 #include "ShaderProgram.hpp"
 #include "OCLRenderer.hpp"
 #include "GLMain.hpp"
+#include "TileServer.hpp"
+#include "RenderCoordinator.hpp"
+#include "RenderWorker.hpp"
+#include "ZoomVideo.hpp"
+#include "ViewControl.hpp"
+#include "InputTrace.hpp"
 
 #define PROGRAM_NAME "Mandelbrot CL"
 
 
 const size_t WIDTH = 1280;
 const size_t HEIGHT = 720;
+// gradient files of the palettes, relative to the working directory like the kernels
+const char *PALETTE_DIRECTORY = "palettes";
 
 int main(int argc, char *argv[])
 {
 	srand48((unsigned int) std::time(nullptr));
+
+	// headless modes: --serve [port] [formula] [iterations] [juliaCX juliaCY], --benchmark-server [port] [connections] [seconds] [maxZoom]
+	if (argc > 1 && std::string(argv[1]) == "--serve")
+	{
+		TileServer server((unsigned short) (argc > 2 ? std::stoi(argv[2]) : 8080), argc > 3 ? argv[3] : "mandelbrot",
+		                  argc > 4 ? std::stoi(argv[4]) : 1000);
+		if (argc > 6)
+			server.setJuliaC(std::stod(argv[5]), std::stod(argv[6]));
+		server.run();
+		return 0;
+	}
+	if (argc > 1 && std::string(argv[1]) == "--benchmark-server")
+	{
+		TileServer::benchmark((unsigned short) (argc > 2 ? std::stoi(argv[2]) : 8080), argc > 3 ? std::stoul(argv[3]) : 16,
+		                      argc > 4 ? std::stod(argv[4]) : 10.0, argc > 5 ? std::stoi(argv[5]) : 8);
+		return 0;
+	}
+	// distributed rendering: --coordinate address width height output [formula] [iterations] [zoom] [posX] [posY],
+	// --work address [device] [partition]
+	if (argc > 5 && std::string(argv[1]) == "--coordinate")
+	{
+		cluster::ViewMessage message;
+		std::memset(&message, 0, sizeof(message));
+		message.width = (uint32_t) std::stoul(argv[3]);
+		message.height = (uint32_t) std::stoul(argv[4]);
+		std::strncpy(message.formula, argc > 6 ? argv[6] : "mandelbrot", sizeof(message.formula) - 1);
+		message.iterations = argc > 7 ? std::stoi(argv[7]) : 1000;
+		// by default the whole set, the image is centered on -0.5
+		message.zoom = argc > 8 ? std::stod(argv[8]) : 4.0;
+		message.posX = argc > 9 ? std::stod(argv[9]) : -0.5 / message.zoom - 0.5;
+		message.posY = argc > 10 ? std::stod(argv[10]) : -0.5 * message.height / message.width;
+		message.juliaCX = -0.53060;
+		message.juliaCY = -0.50340;
+		message.color[0] = 0.0f;
+		message.color[1] = 0.6f;
+		message.color[2] = 1.0f;
+		RenderCoordinator coordinator(argv[2], message);
+		return coordinator.run(argv[5]) ? 0 : 1;
+	}
+	if (argc > 2 && std::string(argv[1]) == "--work")
+	{
+		RenderWorker worker(argc > 3 ? std::stoi(argv[3]) : -1, argc > 4 ? argv[4] : "");
+		return worker.run(argv[2]) ? 0 : 1;
+	}
+
+	// --zoom-video prefix width height [centerX] [centerY] [doublings] [framesPerDoubling] [iterations] [formula] [device]
+	// [partition] [sampleGrid] [juliaCX juliaCY]
+	if (argc > 4 && std::string(argv[1]) == "--zoom-video")
+	{
+		ZoomVideo::Settings settings;
+		settings.width = std::stoul(argv[3]);
+		settings.height = std::stoul(argv[4]);
+		if (argc > 6)
+		{
+			settings.centerX = std::stod(argv[5]);
+			settings.centerY = std::stod(argv[6]);
+		}
+		if (argc > 7)
+			settings.doublings = std::stoul(argv[7]);
+		if (argc > 8)
+			settings.framesPerDoubling = std::stoul(argv[8]);
+		if (argc > 9)
+			settings.iterations = std::stoi(argv[9]);
+		if (argc > 10)
+			settings.formula = argv[10];
+		if (argc > 13)
+			settings.sampleGrid = std::max(std::stoul(argv[13]), 1ul);
+		if (argc > 15)
+		{
+			settings.juliaCX = std::stod(argv[14]);
+			settings.juliaCY = std::stod(argv[15]);
+		}
+		ZoomVideo video(argc > 11 ? std::stoi(argv[11]) : -1, argc > 12 ? argv[12] : "");
+		return video.render(settings, argv[2]) ? 0 : 1;
+	}
+
+	// options of the window: --samples n renders at most n samples per pixel, --noise fraction stops once at most
+	// that fraction of the pixels changed visibly with the last sample, 0 disables either. --record trace writes the
+	// input events to the trace file, --replay trace replays them in a hidden window and reports the latency
+	RenderThread::View view(WIDTH, HEIGHT);
+	std::string recordFilename;
+	std::string replayFilename;
+	for (int i = 1; i + 1 < argc; i += 2)
+	{
+		if (std::string(argv[i]) == "--samples")
+			view.sampleTarget = std::stoi(argv[i + 1]);
+		else if (std::string(argv[i]) == "--noise")
+			view.noiseThreshold = std::stod(argv[i + 1]);
+		else if (std::string(argv[i]) == "--record")
+			recordFilename = argv[i + 1];
+		else if (std::string(argv[i]) == "--replay")
+			replayFilename = argv[i + 1];
+	}
+	std::vector<InputTrace::Entry> trace;
+	if (!replayFilename.empty())
+	{
+		if (!InputTrace::load(replayFilename, trace))
+		{
+			std::cerr << "couldn't read " << replayFilename << std::endl;
+			return 1;
+		}
+		// the same random colors in every replay
+		srand48(0);
+	}
+
 	SDL_Window *mainwindow;
 	SDL_GLContext maincontext;
 
@@ -31,8 +148,8 @@ int main(int argc, char *argv[])
 	SDL_GL_SetAttribute(SDL_GL_DOUBLEBUFFER, 1);
 
 	/* Create our window centered at 512x512 resolution */
-	mainwindow = SDL_CreateWindow(PROGRAM_NAME, SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED,
-	                              WIDTH, HEIGHT, SDL_WINDOW_OPENGL | SDL_WINDOW_SHOWN | SDL_WINDOW_RESIZABLE);
+	mainwindow = SDL_CreateWindow(PROGRAM_NAME, SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED, WIDTH, HEIGHT,
+	                              SDL_WINDOW_OPENGL | (replayFilename.empty() ? SDL_WINDOW_SHOWN : SDL_WINDOW_HIDDEN) | SDL_WINDOW_RESIZABLE);
 	if (!mainwindow)
 	{ /* Die if creation failed */
 		std::cerr << "SDL Error: " << SDL_GetError() << std::endl;
@@ -41,124 +158,42 @@ int main(int argc, char *argv[])
 	}
 
 	bool quit = false;
-	bool needUpdate = true;
-	double zSpeed = 1.25;
-	double width = WIDTH;
-	double height = HEIGHT;
-	double posRelX = 0;
-	double posRelY = 0;
-	double posX = 0;
-	double posY = 0;
-	double oldPosY = 0;
-	double oldPosX = 0;
-	bool leftPressed = false;
-	bool rightPressed = false;
-	GLMain glMain(mainwindow, maincontext);
-	glMain.getOclRenderer()->setZoom(4.0);
-	glMain.getOclRenderer()->setColor({(cl_float) (drand48() * M_PI * 2.0), (cl_float) (drand48() * M_PI * 2.0),
-	                                   (cl_float) (drand48() * M_PI * 2.0)});
-	glMain.getOclRenderer()->setPos(-1.2 / 4.0 * WIDTH / HEIGHT, -1.2 / 4.0);
+	bool needUpdate = false;
+	// the view is owned by the event loop, the render thread picks up the latest one
+	view.zoom = 4.0;
+	view.color = {(cl_float) (drand48() * M_PI * 2.0), (cl_float) (drand48() * M_PI * 2.0), (cl_float) (drand48() * M_PI * 2.0)};
+	view.pos = {-1.2 / 4.0 * WIDTH / HEIGHT, -1.2 / 4.0};
+	ViewControl control(view, Palette::list(PALETTE_DIRECTORY));
+	GLMain glMain(mainwindow, maincontext, view);
 	SDL_Event event;
+	std::shared_ptr<InputTrace> recorder;
+	if (!recordFilename.empty())
+		recorder.reset(new InputTrace(recordFilename));
 
+	if (!replayFilename.empty())
+		quit = !InputTrace::replay(trace, mainwindow, glMain, control, replayFilename + ".latency.csv");
 
-	while (!quit)
+	while (!quit && replayFilename.empty())
 	{
-		glMain.getOclRenderer()->render(needUpdate);
+		if (needUpdate)
+			glMain.getRenderThread()->post(control.getView());
 		needUpdate = false;
 		glMain.display();
 		SDL_GL_SwapWindow(mainwindow);
 
-		while (SDL_PollEvent(&event))
+		// once the image is done nothing changes until the next event, the render thread pushes one when it goes
+		// idle, so its last frame is drawn
+		bool wait = glMain.getRenderThread()->isIdle();
+		while (wait ? SDL_WaitEvent(&event) : SDL_PollEvent(&event))
 		{
-			cl_double2 pos = glMain.getOclRenderer()->getPos();
-			switch (event.type)
-			{
-				case SDL_QUIT:
-					quit = true;
-					break;
-				case SDL_WINDOWEVENT:
-					if (event.window.event == SDL_WINDOWEVENT_RESIZED)
-					{
-						width = event.window.data1;
-						height = event.window.data2;
-						glMain.reshape(event.window.data1, event.window.data2);
-					}
-
-					break;
-				case SDL_KEYDOWN:
-					if (event.key.keysym.sym == SDLK_c)
-					{
-						glMain.getOclRenderer()->setColor(
-								{(cl_float) (drand48() * M_PI * 2.0), (cl_float) (drand48() * M_PI * 2.0),
-								 (cl_float) (drand48() * M_PI * 2.0)});
-						needUpdate = true;
-					}
-					if (event.key.keysym.sym == SDLK_p)
-						glMain.saveRenderedImage();
-					if (event.key.keysym.sym == SDLK_PLUS)
-					{
-						glMain.getOclRenderer()->setIterations((cl_int) (glMain.getOclRenderer()->getIterations() * 1.25 + 1));
-						needUpdate = true;
-					}
-					if (event.key.keysym.sym == SDLK_MINUS)
-					{
-						glMain.getOclRenderer()->setIterations(std::max(1, (cl_int) (glMain.getOclRenderer()->getIterations() * 0.8 - 1)));
-						needUpdate = true;
-					}
-
-				case SDL_MOUSEBUTTONDOWN:
-					if (event.button.button == SDL_BUTTON_LEFT && event.button.state == SDL_PRESSED)
-						leftPressed = true;
-					if (event.button.button == SDL_BUTTON_RIGHT && event.button.state == SDL_PRESSED)
-					{
-						rightPressed = true;
-						oldPosY = posY;
-						oldPosX = posX;
-					}
-					break;
-				case SDL_MOUSEBUTTONUP:
-					if (event.button.button == SDL_BUTTON_LEFT && event.button.state == SDL_RELEASED)
-						leftPressed = false;
-					if (event.button.button == SDL_BUTTON_RIGHT && event.button.state == SDL_RELEASED)
-						rightPressed = false;
-					break;
-				case SDL_MOUSEWHEEL:
-
-					if (event.wheel.y < 0)
-					{
-						glMain.getOclRenderer()->setPos(pos.s[0] * 1.0 / zSpeed - (1.0 - 1.0 / zSpeed) * posX / width,
-						                                pos.s[1] * 1.0 / zSpeed - (1.0 - 1.0 / zSpeed) * (height - posY) / width);
-						glMain.getOclRenderer()->setZoom(glMain.getOclRenderer()->getZoom() * zSpeed);
-					}
-					else if (event.wheel.y > 0)
-					{
-						glMain.getOclRenderer()->setPos(pos.s[0] * zSpeed - (1.0 - zSpeed) * posX / width,
-						                                pos.s[1] * zSpeed - (1.0 - zSpeed) * (height - posY) / width);
-						glMain.getOclRenderer()->setZoom(glMain.getOclRenderer()->getZoom() / zSpeed);
-					}
-					needUpdate = true;
-					break;
-				case SDL_MOUSEMOTION:
-					posRelX = event.motion.xrel;
-					posRelY = event.motion.yrel;
-					posX = event.motion.x;
-					posY = event.motion.y;
-					if (leftPressed)
-					{
-						glMain.getOclRenderer()->setPos(-posRelX / width + pos.s[0], posRelY / width + pos.s[1]);
-						needUpdate = true;
-					}
-					if (rightPressed)
-					{
-						pos = glMain.getOclRenderer()->getPos();
-						double zoomFact = 1.0f - posRelY * 0.02f;
-						glMain.getOclRenderer()->setPos(pos.s[0] * zoomFact - (1.0 - zoomFact) * oldPosX / width,
-						                                pos.s[1] * zoomFact - (1.0 - zoomFact) * (height - oldPosY) / width);
-						glMain.getOclRenderer()->setZoom(glMain.getOclRenderer()->getZoom() / zoomFact);
-						needUpdate = true;
-					}
-					break;
-			}
+			wait = false;
+			if (recorder)
+				recorder->record(event);
+			if (event.type == SDL_QUIT)
+				quit = true;
+			if (event.type == SDL_WINDOWEVENT && event.window.event == SDL_WINDOWEVENT_RESIZED)
+				glMain.reshape(event.window.data1, event.window.data2);
+			needUpdate = control.handle(event) || needUpdate;
 		}
 	}
 	glMain.cleanup();